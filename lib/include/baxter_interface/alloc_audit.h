@@ -0,0 +1,64 @@
+#ifndef __ALLOC_AUDIT_H__
+#define __ALLOC_AUDIT_H__
+
+/**
+ * Allocation audit for the control loops. When the package is configured
+ * with -DALLOC_AUDIT=ON, malloc & co. are interposed (see alloc_audit.cpp)
+ * and every heap allocation made by a thread is counted. In normal builds
+ * all of this compiles down to nothing.
+ */
+namespace alloc_audit
+{
+#ifdef BAXTER_ALLOC_AUDIT
+    /**
+     * Number of allocations performed by the calling thread while not paused.
+     */
+    unsigned long count();
+
+    /**
+     * Suspends/resumes counting for the calling thread. Calls can be nested.
+     */
+    void pause();
+    void resume();
+#else
+    inline unsigned long count() { return 0; }
+    inline void pause()          {            }
+    inline void resume()         {            }
+#endif
+
+    /**
+     * Scoped pause, used around calls into code that is not ours
+     * (IK solver, roscpp serialization) and that allocates internally.
+     */
+    class Pause
+    {
+    public:
+        Pause()  { pause();  }
+        ~Pause() { resume(); }
+    };
+
+    /**
+     * Per-loop checker. Call tick() once per control cycle: after the first
+     * warmup ticks, any allocation counted during a tick is a failure.
+     */
+    class Loop
+    {
+    private:
+        const char  *name;
+        int        warmup;
+        int         ticks;
+        unsigned long last;
+
+    public:
+        Loop(const char *_name, int _warmup = 10) :
+             name(_name), warmup(_warmup), ticks(0), last(count()) { };
+
+        /**
+         * Checks the allocations performed since the previous tick.
+         * @return true if the tick was allocation-free (or still warming up)
+         */
+        bool tick();
+    };
+}
+
+#endif
@@ -2,13 +2,104 @@
 #define __ARM_CONTROLLER_H__
 
 #include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+#include <dynamic_reconfigure/server.h>
 
 #include <robot_utils/ros_thread.h>
 #include <robot_interface/robot_interface.h>
 
+#include "baxter_interface/telemetry_ring.h"
+#include "baxter_interface/timing_stats.h"
+#include "baxter_interface/seqlock.h"
+#include "baxter_interface/resolved_rate.h"
+#include "baxter_interface/motion_library.h"
+#include "baxter_interface/joint_history.h"
+#include "baxter_interface/convergence_monitor.h"
+#include "baxter_interface/cartesian_path.h"
+
+#include <geometry_msgs/Twist.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <sensor_msgs/JointState.h>
+#include <baxter_core_msgs/JointCommand.h>
+#include <baxter_core_msgs/EndpointState.h>
+#include <trajectory_msgs/JointTrajectory.h>
+
 #include "baxter_control/DoAction.h"
 #include "baxter_control/ArmState.h"
 #include "baxter_control/ArmPos.h"
+#include "baxter_control/ArmPosStamped.h"
+#include "baxter_control/ArmCtrlConfig.h"
+
+#define RECOVERY_HOME       0   // go back to the home configuration
+#define RECOVERY_RETREAT    1   // retreat along the recent path, home as a fallback
+
+// Per-axis position tolerances of isPoseReached(), as in RobotInterface [m]
+#define POS_TOL_LOOSE   0.01
+#define POS_TOL_STRICT  0.003
+
+// Sources of stamped targets. Each numbers its targets on its own,
+// so the order is checked per source
+#define TARGET_SRC_TOPIC    0   // the target_stamped topic
+#define TARGET_SRC_MARKERS  1   // the in-process marker pipeline
+#define TARGET_SOURCES      2
+
+// Tolerance modes of isPoseReached(), resolved once per motion (see toleranceMode())
+#define POS_MODE_INVALID   -1
+#define POS_MODE_LOOSE      0
+#define POS_MODE_STRICT     1
+
+// Max joint error of a configuration that counts as reached [rad]
+#define JOINT_TOLERANCE     0.01
+
+/**
+ * Runtime parameters of the controller. Loaded once at startup and then
+ * updated through dynamic reconfigure (see cfg/ArmCtrl.cfg). The control
+ * loops read a consistent snapshot of the whole block, with no RPC nor lock.
+ */
+struct ArmParams
+{
+    double         arm_speed;   // cruise speed of the end-effector [m/s]
+    double         arm_accel;   // acceleration limit [m/s^2], 0 for no limit
+    double         loop_rate;   // rate of the control loops [Hz]
+    double     pos_tolerance;   // [m], 0 to use the RobotInterface defaults
+    double     twist_timeout;   // twist commands older than this are stopped [s]
+
+    // Flag to know if the robot will recover from an error
+    // or will wait the external planner to take care of that
+    bool   internal_recovery;
+    int        recovery_mode;   // RECOVERY_HOME or RECOVERY_RETREAT
+    double  retreat_distance;   // max distance to retreat along the path [m]
+
+    // Stall detection and time bound of the motions (see ConvergenceMonitor)
+    double        stall_time;   // [s]
+    double      min_progress;   // [m]
+    double    timeout_margin;   // [s]
+
+    // Lookahead command mode of the relative moves (see publishLookahead)
+    int          lookahead_k;   // setpoints per message, 0 to disable
+    double      command_rate;   // rate of the messages [Hz]
+};
+
+/**
+ * Latest measured state of the arm. It is published in one step by the state
+ * callbacks, and the control loops read it once per tick, so that every
+ * decision in a tick is based on the same sample. Joints and pose come from
+ * different topics, so each has its own measurement time.
+ */
+struct RobotState
+{
+    double            pos[3];   // end-effector position
+    double            ori[4];   // end-effector orientation (x y z w)
+    double q[BAXTER_NUM_JOINTS];
+
+    bool            has_pose;   // pos and ori are valid
+    bool          has_joints;   // q is valid
+    ros::Time   joints_stamp;   // measurement time of q
+    ros::Time     pose_stamp;   // measurement time of pos and ori
+};
 
 class ArmCtrl : public RobotInterface, public ROSThread
 {
@@ -24,21 +115,137 @@ private:
     int        update_flag;
     int       reached_flag;
 
-    // Flag to know if the robot will recover from an error
-    // or will wait the external planner to take care of that
-    bool internal_recovery;
+    // Set by a twist, to give up the current target without it counting as reached
+    std::atomic<bool> preempt_flag;
+
+    // Flag to know if the arm is driven by an external scheduler
+    // (e.g. DualArmCtrl) instead of its own internal thread
+    std::atomic<bool> external_control;
+
+    // Set by the internal thread once it has seen external_control, and
+    // until control is taken back it does not command the arm anymore
+    std::atomic<bool> external_ack;
+
+    // Runtime parameters, written by the reconfigure server
+    SeqLock<ArmParams>                                          params;
+    dynamic_reconfigure::Server<baxter_control::ArmCtrlConfig> *reconf_server;
 
     ros::ServiceServer service;
     ros::ServiceServer service_other_limb;
 
     ros::Publisher     state_pub;
 
+    // Preallocated state message, reused by publishState(). The state is
+    // set both from the action threads and from the internal thread
+    std::mutex              mtx_state_msg;
+    baxter_control::ArmState    state_msg;
+
     ros::Subscriber    control_topic;
+    ros::Subscriber    control_topic_stamped;
 
     geometry_msgs::Point        _desired_pos;
 
+    // Orientation of the target, only if set by a stamped target
+    geometry_msgs::Quaternion   _desired_ori;
+    bool                     has_desired_ori;
+
+    // Perception time of the current target (zero if unknown)
+    ros::Time               _desired_stamp;
+
+    // Stamped targets older than this are dropped [s]
+    double                   max_target_age;
+    uint64_t                last_target_seq[TARGET_SOURCES];
+    ros::Time             last_target_stamp[TARGET_SOURCES];
+    bool                    got_target_seq[TARGET_SOURCES];
+    unsigned long             n_stale_targets;
+    unsigned long          n_rejected_targets;
+
+    // Latency from the target stamp to its first command
+    TimingStats              target_latency;
+
+    // Serializes the sources of targets (topics, marker pipeline)
+    // and the handovers to and from an external scheduler
+    std::mutex                   mtx_target;
+
+    // Latest observed pose of each object, keyed as the object database
+    std::mutex                              mtx_object_cache;
+    std::map<int, geometry_msgs::PoseStamped>   object_cache;
+
     std::vector<double> home_conf;
 
+    // Cartesian velocity (twist) input, with resolved-rate control
+    struct TwistCmd
+    {
+        double         v[6];    // vx vy vz wx wy wz
+        ros::Time     stamp;    // time of arrival (zero if none yet)
+    };
+
+    ros::Subscriber          twist_sub;
+    ros::Publisher       joint_vel_pub;
+
+    SeqLock<TwistCmd>        twist_cmd;
+    ResolvedRate        *resolved_rate;
+
+    // Latest robot state. The RobotInterface callbacks update their part of
+    // state_w under mtx_state (they may run on different spinner threads),
+    // and then publish the whole of it with a single store. They are
+    // subscribed before ArmCtrl is built, hence state_ready
+    std::atomic<bool>  state_ready;
+    std::mutex           mtx_state;
+    RobotState             state_w;
+    SeqLock<RobotState> robot_state;
+
+    // Preallocated velocity command, reused at every tick
+    baxter_core_msgs::JointCommand joint_vel_cmd;
+
+    // Batches of upcoming joint setpoints (see publishLookahead)
+    ros::Publisher                        traj_pub;
+    trajectory_msgs::JointTrajectory      traj_msg;
+
+    // Library of recurring motions, and buffers to record and replay them
+    MotionLibrary           motion_lib;
+    MotionTrajectory         lib_traj;
+    std::vector<float>          rec_s;  // path parameter of each recorded tick
+    std::vector<float>          rec_q;  // measured joints of each recorded tick
+    int                         rec_n;
+    double                      rec_t;  // time of the last recorded tick [s]
+    std::vector<double>      replay_q;
+
+    // Relative moves, sampled and solved up front (see moveArmRelative),
+    // and buffers for the IK and FK of their segments
+    CartesianPath             path;
+    std::vector<double>     ik_sol;
+    std::vector<double>       fk_x;
+    std::vector<double>       fk_y;
+    std::vector<double>       fk_z;
+
+    // Recent path of the arm, to retreat along it when recovering from errors
+    JointHistory         joint_history;
+    std::vector<JointSample> retreat_path;
+    std::vector<double>       retreat_len;  // Cartesian length of each step [m]
+
+    // Outcome of the motions: settle time of those that reached their goal,
+    // and number of motions per ConvergenceMonitor::Status
+    TimingStats            settle_time;
+    unsigned long   n_motion_outcomes[5];
+
+    // Time spent recovering from errors, per recovery mode
+    TimingStats   recovery_time_home;
+    TimingStats   recovery_time_retreat;
+
+    // Shared-memory telemetry ring for external monitors. The ring has a
+    // single writer: mtx_telemetry is held while writing, and the loop
+    // timing is only computed between ticks of the same thread
+    bool           use_telemetry;
+    TelemetryWriter    telemetry;
+    std::mutex     mtx_telemetry;
+    std::thread::id telemetry_thread;
+    ros::Time          last_tick;
+
+    // Number of actions being executed, so that the idle
+    // internal thread leaves the telemetry to them
+    std::atomic<int> n_running_actions;
+
 protected:
 
     /**
@@ -76,9 +283,40 @@ protected:
     /**
      * Recovers from errors during execution. It provides a basic interface,
      * but it is advised to specialize this function in the ArmCtrl's children.
+     * Depending on the recovery_mode parameter, the arm either goes home, or
+     * retreats along the path it came from (and goes home only if that fails).
      */
     void recoverFromError();
 
+    /**
+     * Moves the arm back along its recent path, up to the last configuration
+     * in which a motion was completed, or up to a max Cartesian distance.
+     * If the arm is still in that configuration (e.g. the failed motion did
+     * not move it), there is nothing to retreat and it succeeds right away.
+     * Each waypoint has to be reached within the time it takes at arm_speed
+     * (as the other motions, see ConvergenceMonitor) plus stall_time.
+     *
+     * @param  max_dist the max distance to retreat [m]
+     * @return          true/false if success/failure
+     */
+    bool retreatAlongPath(double max_dist);
+
+    /**
+     * Logs the outcome of a motion, and updates the statistics
+     *
+     * @param motion  the name of the motion (e.g. "moveArm")
+     * @param m       the monitor of the motion
+     * @param s       how the motion ended
+     * @param error   the final distance to the goal
+     */
+    void reportMotion(const char *motion, ConvergenceMonitor &m,
+                      ConvergenceMonitor::Status s, double error);
+
+    /**
+     * Max joint distance from the home configuration [rad]
+     */
+    double homeError(const RobotState &rs);
+
     /**
      * Hovers above table at a specific x-y position.
      * @param  height the z-axis value of the end-effector position
@@ -132,6 +370,59 @@ protected:
     bool moveArm(std::string dir, double dist, std::string mode = "loose",
                                              bool disable_coll_av = false);
 
+    /**
+     * Moves the arm by an arbitrary translation and rotation, relative to the
+     * current end-effector pose. The whole path is sampled and its IK solved
+     * before the arm moves, so that a move that is not feasible fails
+     * without moving at all; the control loop then streams the joint samples.
+     *
+     * @param dp   the translation, in the base frame [m]
+     * @param drot the rotation of the end-effector, as a rotation vector
+     *             in the base frame [rad]
+     *
+     * @return true/false if success/failure
+     */
+    bool moveArmRelative(const double dp[3], const double drot[3],
+                         std::string mode = "loose", bool disable_coll_av = false);
+
+    /**
+     * Lookahead mode: publishes the next k joint setpoints of the path buffer,
+     * one sample period apart, in a single trajectory message stamped with the
+     * time of the first one. The batches are meant for a robot-side streamer
+     * (subscribed to ~trajectory_topic, not part of this package), which
+     * follows the motion at a fraction of the loop rate without losing time
+     * resolution. While one is subscribed, they replace the per-tick joint
+     * command; otherwise the arm is driven tick by tick as usual.
+     *
+     * @param  t_elap the time since the start of the path [s]
+     * @param  stamp  the time of the first setpoint
+     * @param  k      the number of setpoints
+     */
+    void publishLookahead(double t_elap, const ros::Time &stamp, int k);
+
+    /**
+     * Solves the IK of the path sampled in the path buffer. The IK is solved
+     * at knots along the path, and the joints are interpolated in between;
+     * segments whose interpolation deviates from the path (checked with a
+     * batch FK), or that move the joints too much, are split.
+     *
+     * @param  ik_time the time spent solving the IK [s]
+     * @return         false if some sample has no IK, or the solutions are
+     *                 not continuous
+     */
+    bool solvePathIK(double &ik_time);
+
+    /**
+     * Solves the IK of sample i of the path buffer
+     */
+    bool solvePathKnot(size_t i, double &ik_time);
+
+    /**
+     * Fills in the joints between two solved knots of the path buffer,
+     * splitting the segment as needed (see solvePathIK)
+     */
+    bool refinePathSegment(size_t i0, size_t i1, double &ik_time);
+
     bool movePose();
 
     /**
@@ -268,8 +559,97 @@ protected:
      * @return   true/false if success/failure
      */
 
-    float vector_norm(geometry_msgs::Point x);
-    geometry_msgs::Point vector_difference(geometry_msgs::Point x0, geometry_msgs::Point x1);
+    /**
+     * Callback for the dynamic reconfigure server
+     */
+    void reconfigureCb(baxter_control::ArmCtrlConfig &config, uint32_t level);
+
+    /**
+     * Sends one resolved-rate velocity command, if a fresh twist is available.
+     * When the twist goes stale, the arm is stopped with a zero velocity command.
+     *
+     * @param  p      the current parameters
+     * @param  active whether the arm was in velocity mode (updated)
+     * @return        true if a velocity command has been sent
+     */
+    bool twistTick(const ArmParams &p, bool &active);
+
+    /**
+     * Records the current joint configuration at a given point of the path,
+     * while executing a motion that is not in the library yet. Ticks closer
+     * than MOTION_REC_DT to the last recorded one are skipped.
+     *
+     * @param rs   the robot state of the current tick
+     * @param s    the path parameter, in [0, 1]
+     * @param t    the time since the start of the motion [s]
+     * @param last true to record the tick anyway, as the end of the motion
+     */
+    void recordTick(const RobotState &rs, double s, double t, bool last = false);
+
+    /**
+     * Resamples the recorded ticks and stores them in the motion library
+     *
+     * @param key     the key of the motion
+     * @param ik_time the time spent solving IK during the motion [s]
+     */
+    void storeRecordedMotion(const MotionKey &key, double ik_time);
+
+    /**
+     * Checks that a trajectory from the library can be replayed from the
+     * current configuration, and that its forward kinematics follows the
+     * straight line to the relative goal.
+     *
+     * @param  t    the trajectory
+     * @param  q    the current joint configuration
+     * @param  goal the goal, relative to the start position
+     * @return      true/false if valid/invalid
+     */
+    bool isTrajectoryValid(const MotionTrajectory &t, const double q[BAXTER_NUM_JOINTS],
+                           const double goal[3]);
+
+    /**
+     * Replays a trajectory from the library, with the timing of the live motion
+     *
+     * @return true/false if success/failure
+     */
+    bool replayTrajectory(const MotionTrajectory &t, const geometry_msgs::Point &start,
+                          const geometry_msgs::Point &final, const geometry_msgs::Quaternion &ori,
+                          double dist, const std::string &mode, bool disable_coll_av);
+
+    /**
+     * Publishes joint velocities through the preallocated joint command
+     */
+    void publishJointVelocities(const double qdot[BAXTER_NUM_JOINTS]);
+
+    /**
+     * Rebuilds the rate of a control loop if the loop_rate parameter changed
+     *
+     * @param r  the rate of the loop
+     * @param hz the frequency r has been built with (updated)
+     * @param p  the current parameters
+     */
+    void adaptRate(ros::Rate &r, double &hz, const ArmParams &p);
+
+    /**
+     * Writes the state of the current control tick to the telemetry ring.
+     * Does nothing if the telemetry is disabled. If another loop is writing
+     * to the ring at the same time, the sample is dropped.
+     *
+     * @param rs      the robot state the tick was based on
+     * @param cmd_pos the position commanded in this tick
+     * @param cmd_ori the orientation commanded in this tick
+     * @param des_pos the final desired position of the motion
+     * @param t_tick  the time the tick started
+     */
+    void publishTelemetry(const RobotState                &rs,
+                          const geometry_msgs::Point      &cmd_pos,
+                          const geometry_msgs::Quaternion &cmd_ori,
+                          const geometry_msgs::Point      &des_pos,
+                          const ros::Time                  &t_tick);
+
+    float vector_norm(const geometry_msgs::Point &x);
+    geometry_msgs::Point vector_difference(const geometry_msgs::Point &x0,
+                                           const geometry_msgs::Point &x1);
 
 public:
     /**
@@ -306,8 +686,136 @@ public:
     float ComputeStepSize(float start, float finish, float frequency);
     void updateDesiredPoseCb(const baxter_control::ArmPos::ConstPtr& msg);
 
+    /**
+     * Callback for stamped targets. Targets older than the max_target_age
+     * parameter, and targets with a sequence number not greater than the
+     * last accepted one, are dropped. A sequence number that goes back with
+     * a newer stamp is a restart of the source, and its numbering starts over.
+     *
+     * @param msg the stamped target
+     */
+    void updateDesiredPoseStampedCb(const baxter_control::ArmPosStamped::ConstPtr& msg);
+
+    /**
+     * Same as above, for in-process sources of targets (e.g. MarkerPipeline).
+     * Thread safe. Sequence numbers are only compared with the ones of
+     * the same source.
+     *
+     * @param  msg the stamped target
+     * @param  src the source of the target (TARGET_SRC_*)
+     * @return     true if the target has been accepted
+     */
+    bool setDesiredPoseStamped(const baxter_control::ArmPosStamped &msg,
+                               int src = TARGET_SRC_TOPIC);
+
+    /**
+     * Updates the cached pose of an object, e.g. from marker detection.
+     * Thread safe.
+     *
+     * @param id   the id of the object as read by ARuco
+     * @param pose its pose, in the base frame
+     */
+    void setObjectPose(int id, const geometry_msgs::PoseStamped &pose);
+
+    /**
+     * Gets the latest cached pose of an object. Thread safe.
+     *
+     * @param  id   the requested object
+     * @param  pose its pose, if it has been observed
+     * @return      true/false if the object has been observed or not
+     */
+    bool getObjectPose(int id, geometry_msgs::PoseStamped &pose);
+
+    /**
+     * Callback for the twist topic. A twist preempts any position target,
+     * and is followed until it is older than the twist_timeout parameter.
+     *
+     * @param msg the desired end-effector twist, in the base frame
+     */
+    void twistCb(const geometry_msgs::Twist::ConstPtr& msg);
+
+    /**
+     * Callback for the joint states. Extends the one of RobotInterface,
+     * so that the topic is not subscribed twice, to update the robot
+     * state snapshot
+     */
+    void jointStatesCb(const sensor_msgs::JointState& msg) override;
+
+    /**
+     * Callback for the endpoint state. Extends the one of RobotInterface,
+     * so that the topic is not subscribed twice, to update the robot
+     * state snapshot
+     */
+    void endpointCb(const baxter_core_msgs::EndpointState& msg) override;
+
     void publishState();
 
+    /**
+     * Hands the arm over to (or takes it back from) an external scheduler.
+     * While under external control, the internal thread stops servoing
+     * to its own desired position: any pending target is discarded, and
+     * so are the targets that arrive in the meantime. When control is
+     * taken back, the desired position is the measured one.
+     *
+     * The internal thread may be in the middle of a tick when control is
+     * given away: the scheduler has to waitExternalControl() before
+     * sending its own commands.
+     *
+     * @param _ext true to give control away, false to take it back
+     */
+    void setExternalControl(bool _ext);
+    bool isExternalControl()  { return external_control; };
+
+    /**
+     * Waits for the internal thread to acknowledge a handover
+     * to an external scheduler (see setExternalControl)
+     *
+     * @param  timeout the max time to wait [s]
+     * @return         true if the internal thread has stopped commanding
+     */
+    bool waitExternalControl(double timeout);
+
+    /**
+     * Sends a Cartesian command to the arm, without checking if it is reached.
+     * Meant to be used by an external scheduler.
+     *
+     * @param  p the commanded position
+     * @param  o the commanded orientation
+     * @return   true/false if success/failure
+     */
+    bool sendPoseCommand(const geometry_msgs::Point      &p,
+                         const geometry_msgs::Quaternion &o);
+
+    /**
+     * Checks if the end-effector is at a given position. If the pos_tolerance
+     * parameter is set, it is used instead of the RobotInterface tolerances.
+     *
+     * @param  p    the position to check
+     * @param  mode the tolerance (loose or strict)
+     * @return      true/false if the position is reached or not
+     */
+    bool isPoseReached(const geometry_msgs::Point &p, std::string mode = "loose");
+
+    /**
+     * Same as above, on a given robot state
+     */
+    bool isPoseReached(const RobotState &rs, const geometry_msgs::Point &p,
+                                                 const std::string &mode);
+
+    /**
+     * Same as above, with the tolerance mode already resolved, so that
+     * the control loops do not compare nor build strings at every tick
+     *
+     * @param  mode POS_MODE_LOOSE or POS_MODE_STRICT
+     */
+    bool isPoseReached(const RobotState &rs, const geometry_msgs::Point &p, int mode);
+
+    /**
+     * Resolves a tolerance mode name (loose or strict)
+     * @return POS_MODE_LOOSE, POS_MODE_STRICT, or POS_MODE_INVALID if unknown
+     */
+    static int toleranceMode(const std::string &mode);
+
     /* Self-explaining "setters" */
     void setSubState(std::string _state) { sub_state =  _state; };
     void setMarkerID(int _id)            { marker_id =     _id; };
@@ -329,6 +837,34 @@ public:
     int         getObjectID() { return object_id; };
     std::string getObjName();
     geometry_msgs::Point        getDesiredPos();
+
+    /**
+     * Consistent snapshot of the runtime parameters. Lock-free and RPC-free,
+     * so it can be called at every tick.
+     */
+    ArmParams   getParams()   { return params.load(); };
+
+    /**
+     * Consistent snapshot of the latest robot state. Lock-free, so it can be
+     * called at every tick. Until the first endpoint state arrives, the pose
+     * is taken from RobotInterface.
+     */
+    RobotState  getRobotState();
+
+    /**
+     * Creates a convergence monitor with the given parameters. Public, so
+     * that external schedulers (e.g. DualArmCtrl) bound their motions the
+     * same way as the arm does.
+     *
+     * @param  joint_space true for motions monitored in joint space, whose
+     *                     progress is measured in rad instead of m
+     */
+    static ConvergenceMonitor makeConvergenceMonitor(const ArmParams &p,
+                                                     bool joint_space = false);
+
+    /* Conversions from a robot state */
+    static geometry_msgs::Point      statePos(const RobotState &rs);
+    static geometry_msgs::Quaternion stateOri(const RobotState &rs);
 };
 
 #endif
@@ -0,0 +1,280 @@
+#ifndef __BAXTER_KINEMATICS_H__
+#define __BAXTER_KINEMATICS_H__
+
+#include <math.h>
+#include <stddef.h>
+#include <Eigen/Core>
+
+#define BAXTER_NUM_JOINTS   7
+
+/**
+ * Forward kinematics and Jacobian of the Baxter arms, specialized at compile
+ * time for each limb. The kinematic parameters are constexpr, so that the
+ * compiler folds the (0, +-1) sines and cosines of the link twists away; all
+ * the types are fixed-size, and nothing allocates.
+ *
+ * DH parameters from Ju, Yang, Li, "Kinematics modeling and experimental
+ * verification of Baxter robot" (2014), with the arm mounts of the Baxter URDF.
+ * The end-effector frame is at the end of the hand (w2 + 0.229525 m); a tool
+ * offset along its z axis can be added at run time.
+ *
+ * The batch API works on structure-of-arrays inputs, in blocks of
+ * BAXTER_KIN_LANES configurations, so that the inner loops are vectorized by
+ * the compiler. This is meant for workspace analysis and planning tools.
+ */
+namespace baxter_kinematics
+{
+    enum Limb { LEFT = 0, RIGHT = 1 };
+
+    typedef Eigen::Matrix<double, BAXTER_NUM_JOINTS, 1>   Joints;
+    typedef Eigen::Matrix<double, 6, BAXTER_NUM_JOINTS> Jacobian;
+
+    /**
+     * Standard DH parameters of a link. The twist alpha is stored as its
+     * cosine and sine, which are all either 0 or +-1 for Baxter.
+     */
+    struct DHParam
+    {
+        double      a;
+        double      d;
+        double     ca;
+        double     sa;
+        double offset;
+    };
+
+    template <Limb L>
+    struct LimbParams
+    {
+        // Mount of the arm on the torso, i.e. position and yaw of S0 in the base frame
+        static constexpr double yaw_c  = 0.70710678118654752;
+        static constexpr double yaw_s  = L == LEFT ? 0.70710678118654752
+                                                   : -0.70710678118654752;
+        static constexpr double base_x = 0.024645 + yaw_c * 0.055695;
+        static constexpr double base_y = (L == LEFT ? 0.219645 : -0.219645)
+                                                  + yaw_s * 0.055695;
+        static constexpr double base_z = 0.118588 + 0.011038;
+
+        static constexpr DHParam dh[BAXTER_NUM_JOINTS] =
+        {   //   a       d          cos(al) sin(al) offset
+            { 0.069, 0.27035,   0.0, -1.0, 0.0                },  // s0
+            { 0.0,   0.0,       0.0,  1.0, 1.5707963267948966 },  // s1
+            { 0.069, 0.36435,   0.0, -1.0, 0.0                },  // e0
+            { 0.0,   0.0,       0.0,  1.0, 0.0                },  // e1
+            { 0.010, 0.37429,   0.0, -1.0, 0.0                },  // w0
+            { 0.0,   0.0,       0.0,  1.0, 0.0                },  // w1
+            { 0.0,   0.229525,  1.0,  0.0, 0.0                },  // w2
+        };
+    };
+
+    template <Limb L>
+    constexpr DHParam LimbParams<L>::dh[BAXTER_NUM_JOINTS];
+
+    #define BAXTER_KIN_LANES    8
+
+    namespace detail
+    {
+        /**
+         * Base frame of the chain, for W configurations at a time
+         */
+        template <Limb L, int W>
+        inline void initBase(double R[3][3][W], double t[3][W])
+        {
+            typedef LimbParams<L> P;
+            for (int k = 0; k < W; ++k)
+            {
+                R[0][0][k] = P::yaw_c;  R[0][1][k] = -P::yaw_s; R[0][2][k] = 0.0;
+                R[1][0][k] = P::yaw_s;  R[1][1][k] =  P::yaw_c; R[1][2][k] = 0.0;
+                R[2][0][k] = 0.0;       R[2][1][k] =  0.0;      R[2][2][k] = 1.0;
+                t[0][k]    = P::base_x;
+                t[1][k]    = P::base_y;
+                t[2][k]    = P::base_z;
+            }
+        }
+
+        /**
+         * Right-multiplies W frames by the DH transform of one link:
+         * R <- R Rj, t <- t + R [a cos(q), a sin(q), d]
+         */
+        template <int W>
+        inline void dhStep(const DHParam &p, const double q[W],
+                           double R[3][3][W], double t[3][W])
+        {
+            double c[W], s[W];
+            for (int k = 0; k < W; ++k)
+            {
+                c[k] = cos(q[k] + p.offset);
+                s[k] = sin(q[k] + p.offset);
+            }
+
+            for (int r = 0; r < 3; ++r)
+            {
+                for (int k = 0; k < W; ++k)
+                {
+                    double r0 = R[r][0][k], r1 = R[r][1][k], r2 = R[r][2][k];
+                    double x  = r0 * c[k] + r1 * s[k];
+                    double y  = r1 * c[k] - r0 * s[k];
+
+                    R[r][0][k] = x;
+                    R[r][1][k] = y * p.ca + r2 * p.sa;
+                    R[r][2][k] = r2 * p.ca - y * p.sa;
+                    t[r][k]   += p.a * x + p.d * r2;
+                }
+            }
+        }
+    }
+
+    template <Limb L>
+    class Kinematics
+    {
+    public:
+        typedef baxter_kinematics::Joints     Joints;
+        typedef baxter_kinematics::Jacobian Jacobian;
+
+        /**
+         * Forward kinematics
+         * @param q    the joint positions
+         * @param pos  the position of the end-effector in the base frame
+         * @param rot  its orientation
+         * @param tool an offset along the z axis of the end-effector [m]
+         */
+        static void fk(const Joints &q, Eigen::Vector3d &pos, Eigen::Matrix3d &rot,
+                       double tool = 0.0)
+        {
+            double R[3][3][1], t[3][1];
+            detail::initBase<L, 1>(R, t);
+
+            for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+            {
+                detail::dhStep<1>(LimbParams<L>::dh[j], &q(j), R, t);
+            }
+
+            for (int r = 0; r < 3; ++r)
+            {
+                pos(r) = t[r][0] + tool * R[r][2][0];
+                for (int c = 0; c < 3; ++c)     rot(r, c) = R[r][c][0];
+            }
+        }
+
+        /**
+         * Position of the end-effector only
+         */
+        static Eigen::Vector3d fkPosition(const Joints &q, double tool = 0.0)
+        {
+            Eigen::Vector3d pos;
+            Eigen::Matrix3d rot;
+            fk(q, pos, rot, tool);
+            return pos;
+        }
+
+        /**
+         * Geometric Jacobian, in the base frame, at the end-effector
+         * (rows: vx vy vz wx wy wz)
+         * @param q    the joint positions
+         * @param J    the Jacobian
+         * @param pos  if not NULL, the position of the end-effector
+         * @param tool an offset along the z axis of the end-effector [m]
+         */
+        static void jacobian(const Joints &q, Jacobian &J,
+                             Eigen::Vector3d *pos = NULL, double tool = 0.0)
+        {
+            double R[3][3][1], t[3][1];
+            detail::initBase<L, 1>(R, t);
+
+            // Axis and origin of each joint
+            double z[BAXTER_NUM_JOINTS][3], o[BAXTER_NUM_JOINTS][3];
+
+            for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+            {
+                for (int r = 0; r < 3; ++r)
+                {
+                    z[j][r] = R[r][2][0];
+                    o[j][r] = t[r][0];
+                }
+                detail::dhStep<1>(LimbParams<L>::dh[j], &q(j), R, t);
+            }
+
+            double e[3];
+            for (int r = 0; r < 3; ++r)     e[r] = t[r][0] + tool * R[r][2][0];
+
+            for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+            {
+                double dx = e[0] - o[j][0], dy = e[1] - o[j][1], dz = e[2] - o[j][2];
+
+                J(0, j) = z[j][1] * dz - z[j][2] * dy;
+                J(1, j) = z[j][2] * dx - z[j][0] * dz;
+                J(2, j) = z[j][0] * dy - z[j][1] * dx;
+                J(3, j) = z[j][0];
+                J(4, j) = z[j][1];
+                J(5, j) = z[j][2];
+            }
+
+            if (pos != NULL)    *pos = Eigen::Vector3d(e[0], e[1], e[2]);
+        }
+
+        /**
+         * End-effector positions of many configurations at once
+         *
+         * @param q    structure of arrays: q[j][i] is joint j of configuration i
+         * @param n    the number of configurations
+         * @param px   output, n x coordinates (same for py and pz)
+         * @param tool an offset along the z axis of the end-effector [m]
+         */
+        static void fkBatch(const double *const q[BAXTER_NUM_JOINTS], size_t n,
+                            double *px, double *py, double *pz, double tool = 0.0)
+        {
+            const int W = BAXTER_KIN_LANES;
+
+            double R[3][3][W], t[3][W], qb[W];
+
+            for (size_t i0 = 0; i0 < n; i0 += W)
+            {
+                size_t m = n - i0 < size_t(W) ? n - i0 : size_t(W);
+
+                detail::initBase<L, W>(R, t);
+
+                for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+                {
+                    // The last block is padded with zeros
+                    for (int k = 0; k < W; ++k)
+                    {
+                        qb[k] = size_t(k) < m ? q[j][i0 + k] : 0.0;
+                    }
+                    detail::dhStep<W>(LimbParams<L>::dh[j], qb, R, t);
+                }
+
+                for (size_t k = 0; k < m; ++k)
+                {
+                    px[i0 + k] = t[0][k] + tool * R[0][2][k];
+                    py[i0 + k] = t[1][k] + tool * R[1][2][k];
+                    pz[i0 + k] = t[2][k] + tool * R[2][2][k];
+                }
+            }
+        }
+    };
+
+    /**
+     * Run-time dispatch on the limb, for code that is not templated on it
+     */
+    inline void jacobian(Limb l, const Joints &q, Jacobian &J,
+                         Eigen::Vector3d *pos = NULL, double tool = 0.0)
+    {
+        if (l == LEFT)  Kinematics<LEFT >::jacobian(q, J, pos, tool);
+        else            Kinematics<RIGHT>::jacobian(q, J, pos, tool);
+    }
+
+    inline void fk(Limb l, const Joints &q, Eigen::Vector3d &pos,
+                   Eigen::Matrix3d &rot, double tool = 0.0)
+    {
+        if (l == LEFT)  Kinematics<LEFT >::fk(q, pos, rot, tool);
+        else            Kinematics<RIGHT>::fk(q, pos, rot, tool);
+    }
+
+    inline void fkBatch(Limb l, const double *const q[BAXTER_NUM_JOINTS], size_t n,
+                        double *px, double *py, double *pz, double tool = 0.0)
+    {
+        if (l == LEFT)  Kinematics<LEFT >::fkBatch(q, n, px, py, pz, tool);
+        else            Kinematics<RIGHT>::fkBatch(q, n, px, py, pz, tool);
+    }
+}
+
+#endif
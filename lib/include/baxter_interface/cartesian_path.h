@@ -0,0 +1,87 @@
+#ifndef __CARTESIAN_PATH_H__
+#define __CARTESIAN_PATH_H__
+
+#include <vector>
+#include <stddef.h>
+
+#include "baxter_interface/baxter_kinematics.h"
+
+#define CARTESIAN_PATH_MAX_SAMPLES  4096    // ~40s at CARTESIAN_PATH_DT
+
+// Time between samples, independent of the control rate: the control loop
+// interpolates between them (see jointsAt) [s]
+#define CARTESIAN_PATH_DT           0.01
+
+// Rotations are time-scaled as if they moved a point at this distance from
+// the rotation axis, so that arm_speed also bounds the angular speed [m]
+#define CARTESIAN_PATH_ROT_RADIUS   0.1
+
+/**
+ * A relative Cartesian move (translation plus rotation of the end-effector),
+ * sampled up front every CARTESIAN_PATH_DT along the motion profile, and stored
+ * as a structure of arrays. The loops that fill the buffers have no branches
+ * nor dependencies between samples, so that the compiler vectorizes them.
+ *
+ * The joint buffers are filled in by whoever solves the IK of the path
+ * (see ArmCtrl::solvePathIK); the control loop then just streams them.
+ *
+ * All the memory is reserved at construction.
+ */
+class CartesianPath
+{
+public:
+    /* Samples, uniform in time */
+    std::vector<double> u;                      // path parameter in [0, 1]
+    std::vector<double> x, y, z;                // position
+    std::vector<double> qx, qy, qz, qw;         // orientation
+    std::vector<double> q[BAXTER_NUM_JOINTS];   // joint positions, q[j][i]
+
+private:
+    size_t             n;   // number of samples
+    double            dt;   // time between samples [s]
+
+public:
+    /**
+     * Constructor
+     * @param capacity the max number of samples of a path
+     */
+    CartesianPath(size_t capacity = CARTESIAN_PATH_MAX_SAMPLES);
+
+    /**
+     * Samples a relative move from a start pose. The rotation is about a fixed
+     * axis in the base frame, and applied to the orientation of the end-effector.
+     *
+     * @param  p0    the start position
+     * @param  o0    the start orientation (x y z w)
+     * @param  dp    the translation [m]
+     * @param  drot  the rotation, as a rotation vector in the base frame [rad]
+     * @param  speed the cruise speed [m/s]
+     * @param  accel the acceleration limit [m/s^2] (<= 0 to disable)
+     * @return       false if the path does not fit in the buffers
+     */
+    bool sample(const double p0[3], const double o0[4], const double dp[3],
+                const double drot[3], double speed, double accel);
+
+    /**
+     * Joint positions at a given time, linearly interpolated between samples
+     * (and clamped to the end of the path)
+     *
+     * @param  t  the time since the start of the path [s]
+     * @param  qt the joint positions
+     * @param  pt if not NULL, the position at that time
+     * @return    the path parameter at that time
+     */
+    double jointsAt(double t, double qt[BAXTER_NUM_JOINTS], double pt[3] = NULL);
+
+    /**
+     * Linear interpolation of the joints between samples i0 and i1
+     * (excluded), from the values at the two ends.
+     */
+    void interpolateJoints(size_t i0, size_t i1);
+
+    size_t size()           { return          n; };
+    double getDuration()    { return (n - 1) * dt; };
+    double getDt()          { return         dt; };
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef __CONVERGENCE_MONITOR_H__
+#define __CONVERGENCE_MONITOR_H__
+
+/**
+ * Progress tracking of a motion towards its goal, from the distance to the
+ * goal measured at every tick. The motion is expected to keep getting closer:
+ * the best distance so far has to shrink by min_progress at least every
+ * stall_time, unless the arm is keeping up with its motion profile (e.g.
+ * during a slow acceleration ramp, when the profile itself barely moves).
+ * Otherwise the motion is either
+ *
+ *  - oscillating: the distance keeps going up and down (by more than half
+ *    of min_progress) without improving on the best one, or
+ *  - stalled:     it is not improving, nor oscillating, e.g. the arm is
+ *    blocked, or it has settled just outside the tolerance.
+ *
+ * Once the distance has started going up and down, the decision is deferred
+ * to a longer window (a few stall_time), so that slow oscillations have the
+ * time to show their reversals instead of being reported as stalls.
+ *
+ * On top of that, every motion is bounded in time: it may last at most
+ * timeout_factor times its expected duration, plus timeout_margin.
+ *
+ * The monitor is a plain value: it does not allocate, and it is meant to be
+ * a local variable of each motion loop.
+ */
+class ConvergenceMonitor
+{
+public:
+    enum Status
+    {
+        CONVERGING  = 0,
+        REACHED     = 1,
+        STALLED     = 2,
+        OSCILLATING = 3,
+        TIMEOUT     = 4
+    };
+
+private:
+    double        stall_time;   // [s]
+    double      min_progress;   // [m] or [rad], depending on the motion
+    double    timeout_factor;
+    double    timeout_margin;   // [s]
+
+    double           t_start;
+    double         t_timeout;
+    double             d_start;
+    double            d_best;
+    double            t_best;   // time of the last improvement on d_best
+    double            d_last;
+    double        d_extremum;   // last local min/max, for the reversals
+    int            direction;   // +1 going away, -1 getting closer, 0 unknown
+    int          n_reversals;   // since the last improvement
+    double             slope;   // filtered slope of the distance [unit/s]
+    double            t_last;
+
+public:
+    /**
+     * Constructor
+     * @param _stall_time     max time without progress [s]
+     * @param _min_progress   progress expected every _stall_time
+     * @param _timeout_factor max duration, relative to the expected one
+     * @param _timeout_margin max duration, in addition to the above [s]
+     */
+    ConvergenceMonitor(double _stall_time = 1.0, double _min_progress = 0.002,
+                       double _timeout_factor = 1.5, double _timeout_margin = 2.0);
+
+    /**
+     * Starts monitoring a new motion
+     * @param t        the current time [s]
+     * @param d        the current distance to the goal
+     * @param expected the expected duration of the motion [s]
+     */
+    void reset(double t, double d, double expected);
+
+    /**
+     * Updates the monitor with the distance measured in this tick
+     * @param  t     the current time [s]
+     * @param  d     the distance to the goal
+     * @param  d_ref the distance to the goal expected by the motion profile
+     *               at this time, or a negative value if there is no profile
+     * @return       CONVERGING, STALLED, OSCILLATING or TIMEOUT
+     */
+    Status update(double t, double d, double d_ref = -1.0);
+
+    /* Self-explaining "getters" */
+    double getElapsed(double t)  { return t - t_start; };
+    double getDistance()         { return      d_last; };
+    double getStartDistance()    { return     d_start; };
+    double getSlope()            { return       slope; };
+    bool   isTimedOut(double t)  { return t > t_timeout; };
+
+    static const char* statusToString(Status s);
+};
+
+#endif
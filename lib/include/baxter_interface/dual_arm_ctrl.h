@@ -0,0 +1,92 @@
+#ifndef __DUAL_ARM_CONTROLLER_H__
+#define __DUAL_ARM_CONTROLLER_H__
+
+#include <mutex>
+
+#include <robot_utils/ros_thread.h>
+
+#include "baxter_interface/arm_ctrl.h"
+#include "baxter_control/DualArmPos.h"
+
+/**
+ * Coordinated dual-arm Cartesian motion. A single scheduler takes over both
+ * ArmCtrl's, and drives their setpoints from a shared clock: both straight-line
+ * paths are time-scaled to the duration of the slower arm, so that the two
+ * limbs start and arrive together. Commands for both arms are sent in the
+ * same tick. Paired motions are bounded as the single-arm ones (see
+ * ConvergenceMonitor): a pair that stalls or times out is given up, and
+ * both arms are handed back.
+ */
+class DualArmCtrl : public ROSThread
+{
+private:
+    std::string     name;
+
+    ArmCtrl        *left;
+    ArmCtrl       *right;
+
+    ros::NodeHandle    _n;
+    ros::Subscriber target_sub;
+
+    // Paired target received from the topic, guarded by mtx_target
+    std::mutex          mtx_target;
+    geometry_msgs::Point  left_goal;
+    geometry_msgs::Point right_goal;
+    bool            new_target;
+
+    /**
+     * State of one arm along the current coordinated segment
+     */
+    struct Segment
+    {
+        geometry_msgs::Point      start;
+        geometry_msgs::Point       goal;
+        geometry_msgs::Quaternion   ori;
+    };
+
+    /**
+     * Initializes a segment from the current pose of the arm to a goal.
+     * @return the length of the segment
+     */
+    double initSegment(ArmCtrl *arm, const geometry_msgs::Point &goal, Segment &seg);
+
+    /**
+     * Distance of the end-effector from a position
+     */
+    double distance(const RobotState &rs, const geometry_msgs::Point &p);
+
+    /**
+     * Linear interpolation along a segment.
+     * @param  s the path parameter in [0, 1]
+     */
+    geometry_msgs::Point interpolate(const Segment &seg, double s);
+
+    /**
+     * Rate of the coordinated loop: the faster loop_rate of the two arms
+     */
+    double loopRate();
+
+protected:
+    /**
+     * Coordinated motion loop.
+     */
+    void InternalThreadEntry();
+
+public:
+    /**
+     * Constructor
+     * @param _name  the name of the node, used as namespace for the topic
+     * @param _left  the left  arm controller
+     * @param _right the right arm controller
+     */
+    DualArmCtrl(std::string _name, ArmCtrl *_left, ArmCtrl *_right);
+
+    ~DualArmCtrl();
+
+    /**
+     * Callback for the paired target topic
+     */
+    void targetCb(const baxter_control::DualArmPos::ConstPtr& msg);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __JOINT_HISTORY_H__
+#define __JOINT_HISTORY_H__
+
+#include <mutex>
+#include <vector>
+
+#include "baxter_interface/baxter_kinematics.h"
+
+/**
+ * A joint configuration in the history, with a flag to know if the arm
+ * was in a safe state (i.e. had just completed a motion) when it was there.
+ */
+struct JointSample
+{
+    double q[BAXTER_NUM_JOINTS];
+    bool                   safe;
+};
+
+/**
+ * Fixed-size ring buffer of the recent joint configurations of an arm.
+ * A new sample is only added once the arm has moved by a minimum amount from
+ * the previous one, so that the buffer spans a path rather than a time window.
+ * It is used to retreat along the path the arm came from when recovering
+ * from an error. All the memory is reserved at construction.
+ */
+class JointHistory
+{
+private:
+    std::mutex                 mtx;
+    std::vector<JointSample>   buf;
+
+    size_t                    head;     // index of the next sample to write
+    size_t                       n;     // number of valid samples
+    double                min_step;     // [rad], max over the joints
+
+public:
+    /**
+     * Constructor
+     * @param _capacity the max number of samples
+     * @param _min_step the min joint displacement between two samples [rad]
+     */
+    JointHistory(size_t _capacity = 1024, double _min_step = 0.01);
+
+    /**
+     * Adds a configuration, if it is far enough from the last one
+     */
+    void push(const double q[BAXTER_NUM_JOINTS]);
+
+    /**
+     * Marks the most recent sample as safe
+     */
+    void markSafe();
+
+    /**
+     * Copies the path back from the most recent sample to the most recent safe
+     * one (included), or to the oldest one if none is safe. If the most recent
+     * sample is itself safe, that is the only one copied.
+     *
+     * @param  path the output path, most recent first. Only the first
+     *              path.size() samples are filled, so no allocation happens.
+     * @return      the number of samples copied
+     */
+    size_t getRetreatPath(std::vector<JointSample> &path);
+
+    void clear();
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef __MARKER_PIPELINE_H__
+#define __MARKER_PIPELINE_H__
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <ros/ros.h>
+#include <image_transport/image_transport.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <tf/transform_listener.h>
+
+#include <aruco/aruco.h>
+
+#include "baxter_interface/arm_ctrl.h"
+#include "baxter_interface/timing_stats.h"
+
+/**
+ * In-process ArUco detection. Images are received through image_transport and
+ * handed over to a pool of worker threads, each with its own detector. Frames
+ * wait in a short queue: when the workers can not keep up, the oldest frame is
+ * dropped, so that the detections are always based on the freshest images.
+ *
+ * The pose of every detected marker is transformed to the base frame and
+ * pushed to the object cache of each arm. If the marker is the current target
+ * of an arm (see ArmCtrl::setMarkerID), a stamped target is also sent to that
+ * arm, approach_height above the marker and with the current orientation of
+ * the end-effector. Targets are numbered by frame, so that a frame processed
+ * late by a slow worker can not override a newer one.
+ *
+ * Parameters (in the namespace of the node):
+ *   aruco_image_topic      the image topic
+ *   aruco_info_topic       the camera_info topic, for the intrinsics
+ *   aruco_base_frame       the frame of the arm targets
+ *   aruco_marker_size      the side of the markers [m]
+ *   aruco_approach_height  the offset of the targets along z [m]
+ *   aruco_workers          the number of worker threads
+ *   aruco_queue_size       the max number of frames waiting for a worker
+ */
+class MarkerPipeline
+{
+private:
+    std::string                      name;
+    ros::NodeHandle                    _n;
+
+    image_transport::ImageTransport    it;
+    image_transport::Subscriber image_sub;
+    ros::Subscriber              info_sub;
+
+    tf::TransformListener     tf_listener;
+
+    std::vector<ArmCtrl*>            arms;
+
+    std::string                base_frame;
+    double                    marker_size;
+    double                approach_height;
+    int                         n_workers;
+    int                        queue_size;
+
+    // Camera intrinsics, guarded by mtx_cam
+    std::mutex                    mtx_cam;
+    aruco::CameraParameters    cam_params;
+    bool                          has_cam;
+
+    /**
+     * A frame waiting for a worker
+     */
+    struct Frame
+    {
+        sensor_msgs::ImageConstPtr    img;
+        uint64_t                      seq;
+    };
+
+    // Frames waiting for a worker, guarded by mtx_queue
+    std::mutex                  mtx_queue;
+    std::condition_variable      cv_queue;
+    std::deque<Frame>               queue;
+    uint64_t                     n_frames;
+    unsigned long               n_dropped;
+    bool                             stop;
+
+    std::vector<std::thread>      workers;
+
+    // Latency from the image stamp to the markers being pushed to the arms,
+    // guarded by mtx_stats
+    std::mutex                  mtx_stats;
+    TimingStats                   latency;
+    unsigned long               n_markers;
+
+    /**
+     * Main loop of the worker threads
+     */
+    void workerLoop();
+
+    /**
+     * Detects the markers in a frame, and pushes their poses to the arms
+     *
+     * @param detector the detector of the calling worker
+     * @param f        the frame
+     */
+    void processFrame(aruco::MarkerDetector &detector, const Frame &f);
+
+public:
+    /**
+     * Constructor
+     * @param _name the name of the node, used as namespace for the parameters
+     * @param _arms the arms the markers are pushed to
+     */
+    MarkerPipeline(std::string _name, const std::vector<ArmCtrl*> &_arms);
+
+    ~MarkerPipeline();
+
+    /**
+     * Callback for the images: only queues the frame
+     */
+    void imageCb(const sensor_msgs::ImageConstPtr& msg);
+
+    /**
+     * Callback for the camera intrinsics
+     */
+    void cameraInfoCb(const sensor_msgs::CameraInfoConstPtr& msg);
+};
+
+#endif
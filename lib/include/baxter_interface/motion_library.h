@@ -0,0 +1,136 @@
+#ifndef __MOTION_LIBRARY_H__
+#define __MOTION_LIBRARY_H__
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+#include "baxter_interface/baxter_kinematics.h"
+
+/**
+ * Persistent library of recurring motions. Joint trajectories that have been
+ * executed successfully are stored, keyed by the quantized start configuration
+ * and the relative goal of the motion, in a fixed-size file that is mmapped by
+ * every controller (both limbs, across restarts). When the same motion is
+ * requested again, it is replayed from the library instead of solving the IK
+ * along the whole path.
+ *
+ * Each entry is protected by its own sequence counter (odd while the entry is
+ * being written), and writers serialize on an flock of the file.
+ */
+
+#define MOTION_LIB_MAGIC       0x42584d4c  // "BXML"
+#define MOTION_LIB_VERSION              1
+#define MOTION_LIB_ENTRIES            256
+#define MOTION_LIB_SAMPLES            128  // samples per trajectory, uniform along the path
+#define MOTION_LIB_PROBES               8  // open addressing: slots checked per key
+
+#define MOTION_LIB_Q_STEP            0.05  // quantization of the start configuration [rad]
+#define MOTION_LIB_X_STEP           0.005  // quantization of the relative goal [m]
+
+#define MOTION_LIB_PATH_TOL          0.02  // max deviation of a replay from the straight path [m]
+#define MOTION_LIB_GOAL_TOL          0.01  // max distance of the end of a replay from the goal [m]
+
+struct MotionKey
+{
+    int32_t      limb;                  // 0 left, 1 right
+    int32_t      mode;                  // 0 loose, 1 strict
+    int32_t      q0[BAXTER_NUM_JOINTS]; // quantized start configuration
+    int32_t      goal[3];               // quantized relative goal
+};
+
+struct MotionEntry
+{
+    std::atomic<uint32_t>   seq;
+    uint32_t               used;
+    MotionKey               key;
+    uint32_t             n_hits;
+    float               ik_time;    // time spent solving IK when it was recorded [s]
+    float                     q[MOTION_LIB_SAMPLES][BAXTER_NUM_JOINTS];
+};
+
+struct MotionLibraryFile
+{
+    uint32_t          magic;
+    uint32_t        version;
+    uint32_t      n_entries;
+    uint32_t      n_samples;
+    MotionEntry     entries[MOTION_LIB_ENTRIES];
+};
+
+/**
+ * A trajectory as stored in the library
+ */
+struct MotionTrajectory
+{
+    float       q[MOTION_LIB_SAMPLES][BAXTER_NUM_JOINTS];
+    float       ik_time;
+};
+
+class MotionLibrary
+{
+private:
+    std::string         path;
+    int                   fd;
+    MotionLibraryFile   *lib;
+
+    // Statistics of this controller
+    unsigned long     n_hits;
+    unsigned long   n_misses;
+    unsigned long  n_invalid;
+    double        time_saved;
+
+    static uint32_t hash(const MotionKey &k);
+
+public:
+    MotionLibrary();
+    ~MotionLibrary();
+
+    /**
+     * Maps the library file, creating it if needed.
+     * @return true/false if success/failure
+     */
+    bool open(const std::string &_path);
+
+    void close();
+
+    bool isOpen() { return lib != NULL; };
+
+    /**
+     * Builds the key of a motion
+     * @param limb the limb (left or right)
+     * @param mode the tolerance mode (loose or strict)
+     * @param q0   the start configuration
+     * @param goal the goal, relative to the start position [m]
+     */
+    static MotionKey makeKey(const std::string &limb, const std::string &mode,
+                             const double q0[BAXTER_NUM_JOINTS], const double goal[3]);
+
+    /**
+     * Looks a motion up.
+     * @param  k the key of the motion
+     * @param  t the stored trajectory, if found
+     * @return   true if found
+     */
+    bool lookup(const MotionKey &k, MotionTrajectory &t);
+
+    /**
+     * Stores (or replaces) a motion.
+     * @return true/false if success/failure
+     */
+    bool store(const MotionKey &k, const MotionTrajectory &t);
+
+    /**
+     * Statistics, to be called by the user of the library after each motion
+     */
+    void recordHit(double saved)    { ++n_hits; time_saved += saved; };
+    void recordMiss()               { ++n_misses;                    };
+    void recordInvalid()            { ++n_invalid; ++n_misses;       };
+
+    /**
+     * Statistics in human terms, e.g. "hits 10 misses 2 (83.3%), invalid 0, saved 1.2 s"
+     */
+    std::string statsToString();
+};
+
+#endif
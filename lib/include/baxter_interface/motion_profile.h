@@ -0,0 +1,33 @@
+#ifndef __MOTION_PROFILE_H__
+#define __MOTION_PROFILE_H__
+
+/**
+ * Trapezoidal velocity profile along a path of a given length: constant
+ * acceleration up to the cruise speed, cruise, and symmetric deceleration.
+ * If the path is too short to reach the cruise speed, the profile is
+ * triangular. A non-positive acceleration means no acceleration limit,
+ * i.e. the legacy constant-speed motion.
+ */
+namespace motion_profile
+{
+    /**
+     * Time needed to cover the path
+     * @param  dist  the length of the path [m]
+     * @param  speed the cruise speed [m/s]
+     * @param  accel the acceleration limit [m/s^2] (<= 0 to disable)
+     * @return       the duration [s]
+     */
+    double duration(double dist, double speed, double accel);
+
+    /**
+     * Distance covered along the path at a given time, clamped to [0, dist]
+     * @param  t     the time since the start of the motion [s]
+     * @param  dist  the length of the path [m]
+     * @param  speed the cruise speed [m/s]
+     * @param  accel the acceleration limit [m/s^2] (<= 0 to disable)
+     * @return       the distance covered [m]
+     */
+    double position(double t, double dist, double speed, double accel);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef __RESOLVED_RATE_H__
+#define __RESOLVED_RATE_H__
+
+#include <string>
+
+#include "baxter_interface/baxter_kinematics.h"
+
+/**
+ * Resolved-rate controller: maps a Cartesian velocity of the end-effector to
+ * joint velocities through a damped-least-squares inverse of the Jacobian,
+ *
+ *     qdot = J^T (J J^T + lambda^2 I)^-1 v
+ *
+ * The damping is zero away from singularities, and grows as the
+ * manipulability drops below a threshold. Joint velocities that push a joint
+ * into its limit are scaled down to zero within a margin from the limit, and
+ * the whole vector is scaled to respect the velocity limits of the joints.
+ * No IK is solved: this is meant for streaming (teleoperation, visual servoing).
+ *
+ * The twist is that of the end of the hand (see baxter_kinematics), moved
+ * along its z axis by the tool offset, e.g. to the fingertips of a gripper.
+ */
+class ResolvedRate
+{
+private:
+    baxter_kinematics::Limb         limb;
+    double                          tool;   // offset from the end of the hand [m]
+
+    double        manipulability;
+
+    double           w_threshold;   // manipulability below which to damp
+    double            lambda_max;   // damping at the singularity
+    double          limit_margin;   // distance from the joint limits [rad]
+
+public:
+    /**
+     * Constructor
+     * @param _limb the limb (left or right)
+     * @param _tool the offset of the controlled point along the z axis
+     *              of the end of the hand [m]
+     */
+    ResolvedRate(const std::string &_limb, double _tool = 0.0);
+
+    /**
+     * Computes the joint velocities for a desired end-effector twist
+     *
+     * @param  q     the current joint positions
+     * @param  twist the desired twist, in the base frame
+     *               (vx vy vz wx wy wz, at the tool offset)
+     * @param  qdot  the joint velocities to command
+     * @return       true/false if success/failure
+     */
+    bool computeJointVelocities(const double q[BAXTER_NUM_JOINTS],
+                                const double twist[6],
+                                double qdot[BAXTER_NUM_JOINTS]);
+
+    /**
+     * Manipulability measure sqrt(det(J J^T)) at the last computation
+     */
+    double getManipulability()  { return manipulability; };
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __SEQLOCK_H__
+#define __SEQLOCK_H__
+
+#include <atomic>
+
+/**
+ * Single-writer sequence lock around a trivially copyable value.
+ * The writer never blocks, and readers never block the writer: a reader that
+ * overlaps with a write simply copies the value again. This is meant for small
+ * structs that are written rarely, or by one thread only, and read often from
+ * the control loops (e.g. parameters, latest robot state).
+ *
+ * store() must not be called concurrently from more than one thread.
+ */
+template <typename T>
+class SeqLock
+{
+private:
+    std::atomic<unsigned> seq;
+    T                    data;
+
+public:
+    SeqLock() : seq(0), data() { };
+    explicit SeqLock(const T &v) : seq(0), data(v) { };
+
+    void store(const T &v)
+    {
+        unsigned s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);    // odd: being written
+        std::atomic_thread_fence(std::memory_order_release);
+
+        data = v;
+
+        seq.store(s + 2, std::memory_order_release);    // even: consistent
+    }
+
+    T load() const
+    {
+        T v;
+        unsigned s0, s1;
+        do
+        {
+            s0 = seq.load(std::memory_order_acquire);
+            v  = data;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s1 = seq.load(std::memory_order_relaxed);
+        }
+        while ((s0 & 1) || s0 != s1);
+
+        return v;
+    }
+
+    /**
+     * Number of completed writes, e.g. to detect that a new value is there
+     */
+    unsigned version() const
+    {
+        return seq.load(std::memory_order_acquire) / 2;
+    }
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __STRESS_RUNNER_H__
+#define __STRESS_RUNNER_H__
+
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include "baxter_interface/arm_ctrl.h"
+#include "baxter_interface/telemetry_ring.h"
+#include "baxter_interface/timing_stats.h"
+
+/**
+ * Headless stress test of many controllers in one process, to size how many
+ * of them fit on a given host. It creates N ArmCtrl's without a robot, each in
+ * its own namespace (<name>_stress_<i>), and drives each of them with a
+ * synthetic stream of ArmPos targets along a small circle. The streams are
+ * ros::Timer's, so they run on the spinner threads of the process (which
+ * also serve the callbacks of every controller).
+ *
+ * Each controller is followed through its telemetry ring; periodically, the
+ * runner reports for every instance the jitter of its control loop (i.e. how
+ * far the period of each tick is from the nominal one), the CPU used by its
+ * control thread, and the memory that was allocated when it was created.
+ *
+ * Parameters (in the namespace of the node):
+ *   stress_rate    rate of the synthetic targets of each instance [Hz]
+ *   stress_radius  radius of the circle followed by the targets [m]
+ *   stress_report  period of the reports [s]
+ */
+class StressRunner
+{
+private:
+    std::string         name;
+    ros::NodeHandle       _n;
+
+    double              rate;
+    double            radius;
+    double     report_period;
+
+    struct Instance
+    {
+        std::string          name;
+        std::string          limb;
+        ArmCtrl              *arm;
+        ros::Publisher target_pub;
+        ros::Timer          timer;
+        geometry_msgs::Point center;    // center of the circle of targets
+        double             phase0;      // start of the instance along the circle [rad]
+
+        TelemetryReader telemetry;
+        bool       telemetry_open;
+        TimingStats        jitter;
+        double           cpu_last;  // CPU time of the control thread at the last report [s]
+        double           cpu_curr;
+        long            rss_delta;  // memory allocated when creating the instance [kB]
+        unsigned long   n_targets;
+
+        Instance() : arm(NULL), phase0(0.0), telemetry_open(false), jitter(1000), cpu_last(0.0),
+                     cpu_curr(0.0), rss_delta(0), n_targets(0) { };
+    };
+
+    std::vector<Instance*> instances;
+
+    ros::Timer      report_timer;
+    ros::WallTime    last_report;
+    double      process_cpu_last;
+
+    /**
+     * Publishes the next synthetic target of an instance
+     */
+    void targetCb(const ros::TimerEvent &e, Instance *inst);
+
+    /**
+     * Drains the telemetry of every instance, and reports every report_period
+     */
+    void reportCb(const ros::TimerEvent &e);
+
+    /**
+     * Resident memory of the process [kB]
+     */
+    static long residentMemory();
+
+    /**
+     * CPU time used by the whole process so far [s]
+     */
+    static double processCpuTime();
+
+public:
+    /**
+     * Constructor. The spinner of the process should already be running,
+     * since the controllers go home while they are being created.
+     *
+     * @param _name the name of the node, used as prefix for the instances
+     * @param n     the number of instances
+     */
+    StressRunner(std::string _name, int n);
+
+    ~StressRunner();
+};
+
+#endif
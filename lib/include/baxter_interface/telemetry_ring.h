@@ -0,0 +1,152 @@
+#ifndef __TELEMETRY_RING_H__
+#define __TELEMETRY_RING_H__
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+/**
+ * Shared-memory telemetry ring. The controller (single writer) pushes one
+ * TelemetrySample per control tick into a fixed-size ring that lives in
+ * /dev/shm; any number of external processes can map it read-only and follow
+ * the arm at the full control rate, without going through ROS.
+ *
+ * Every slot is protected by its own sequence counter (odd while the slot is
+ * being written), so that neither side ever blocks: the writer never waits
+ * for readers, and a reader that gets lapped simply skips ahead.
+ *
+ * This header and telemetry_ring.cpp do not depend on ROS, so that monitors
+ * can link against the baxter_telemetry library alone.
+ */
+
+#define TELEMETRY_MAGIC     0x42415854  // "BAXT"
+#define TELEMETRY_VERSION            2
+#define TELEMETRY_CAPACITY        1024  // ~10s at 100Hz
+#define TELEMETRY_READ_ATTEMPTS      8  // slots tried by TelemetryReader::latest()
+
+struct TelemetrySample
+{
+    uint64_t    index;      // absolute sample number, starting from 0
+    double      stamp;      // time of the tick [s]
+
+    double  meas_pos[3];    // measured end-effector position
+    double  meas_ori[4];    // measured end-effector orientation (x y z w)
+    double   cmd_pos[3];    // commanded position for this tick
+    double   cmd_ori[4];    // commanded orientation for this tick
+    double   des_pos[3];    // final desired position of the motion
+
+    int32_t     state;      // controller state, as in RobotInterface
+    float     loop_dt;      // time since the previous tick [s]
+    float   loop_work;      // time spent computing this tick [s]
+    double   cpu_time;      // CPU time used by the controller thread so far [s]
+};
+
+struct TelemetrySlot
+{
+    std::atomic<uint64_t>   seq;
+    TelemetrySample      sample;
+};
+
+struct TelemetryRing
+{
+    uint32_t                magic;
+    uint32_t              version;
+    uint32_t             capacity;
+    uint32_t          sample_size;
+    std::atomic<uint64_t>    head;  // number of samples written so far
+    TelemetrySlot           slots[TELEMETRY_CAPACITY];
+};
+
+/**
+ * Name of the shared memory segment of a given controller and limb,
+ * e.g. /baxter_control_move_baxter_right
+ */
+std::string telemetryShmName(const std::string &name, const std::string &limb);
+
+class TelemetryWriter
+{
+private:
+    std::string    shm_name;
+    TelemetryRing     *ring;
+
+public:
+    TelemetryWriter();
+    ~TelemetryWriter();
+
+    /**
+     * Creates (or re-initializes) the shared memory segment.
+     * @return true/false if success/failure
+     */
+    bool open(const std::string &_shm_name);
+
+    /**
+     * Unmaps and unlinks the segment.
+     */
+    void close();
+
+    bool isOpen() { return ring != NULL; };
+
+    /**
+     * Publishes a sample. The index field is filled in by the writer.
+     * Wait-free, and does not allocate.
+     *
+     * There must be a single writer: write() is not safe to call from
+     * several threads at once (two writers would fill in the same slot,
+     * and readers could get torn samples that pass the sequence check).
+     * Callers that write from more than one thread have to serialize
+     * the calls themselves.
+     */
+    void write(const TelemetrySample &s);
+};
+
+class TelemetryReader
+{
+private:
+    const TelemetryRing *ring;
+    uint64_t           cursor;
+    uint64_t          dropped;
+
+public:
+    TelemetryReader();
+    ~TelemetryReader();
+
+    /**
+     * Maps an existing segment read-only. The reader starts from the most
+     * recent sample.
+     * @return true/false if success/failure (e.g. the controller is not running
+     *         or the layout version does not match)
+     */
+    bool open(const std::string &shm_name);
+
+    void close();
+
+    /**
+     * Reads the next sample in order, if any.
+     * @param  s the sample read
+     * @return   true if a new sample was available
+     */
+    bool next(TelemetrySample &s);
+
+    /**
+     * Reads the most recent sample, skipping whatever is in between. If the
+     * newest slots can not be read consistently, older ones are tried, up to
+     * TELEMETRY_READ_ATTEMPTS slots back.
+     * @param  s the sample read
+     * @return   true if a sample could be read
+     */
+    bool latest(TelemetrySample &s);
+
+    /**
+     * Number of samples that were overwritten before this reader got to them.
+     */
+    uint64_t getDropped() { return dropped; };
+
+private:
+    /**
+     * Copies sample i out of its slot.
+     * @return false if the slot was being written or already held a newer sample
+     */
+    bool readSlot(uint64_t i, TelemetrySample &s);
+};
+
+#endif
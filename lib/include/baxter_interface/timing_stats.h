@@ -0,0 +1,59 @@
+#ifndef __TIMING_STATS_H__
+#define __TIMING_STATS_H__
+
+#include <string>
+#include <vector>
+
+/**
+ * Sliding-window statistics over timing samples (latencies, durations, ..).
+ * All the memory is reserved at construction, so that add() can be called
+ * from the control loops without allocating.
+ */
+class TimingStats
+{
+private:
+    std::vector<double> samples;    // circular window
+    std::vector<double> scratch;    // work buffer for the percentiles
+
+    size_t            next;
+    size_t               n;
+    unsigned long    total;
+
+public:
+    /**
+     * Constructor
+     * @param _window the number of most recent samples kept
+     */
+    TimingStats(size_t _window = 1000);
+
+    /**
+     * Adds a sample to the window
+     */
+    void add(double x);
+
+    /**
+     * Percentile of the samples in the window
+     * @param  p the percentile, in [0, 100]
+     * @return   the value (0 if the window is empty)
+     */
+    double percentile(double p);
+
+    /**
+     * Mean of the samples in the window (0 if empty)
+     */
+    double mean();
+
+    /**
+     * Number of samples in the window, and overall
+     */
+    size_t        size()     { return     n; };
+    unsigned long getTotal() { return total; };
+
+    /**
+     * Summary of the window in human terms, with values in milliseconds,
+     * e.g. "n 100 mean 3.2 p50 3.0 p90 4.1 p99 6.8 max 7.0 [ms]"
+     */
+    std::string toString();
+};
+
+#endif
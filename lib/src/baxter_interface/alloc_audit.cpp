@@ -0,0 +1,91 @@
+#include "baxter_interface/alloc_audit.h"
+
+#include <stdlib.h>
+#include <ros/console.h>
+
+#ifdef BAXTER_ALLOC_AUDIT
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t n, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void *__libc_memalign(size_t align, size_t size);
+    void  __libc_free(void *ptr);
+}
+
+// initial-exec keeps the TLS access itself from going through malloc
+static __thread unsigned long n_allocs __attribute__((tls_model("initial-exec"))) = 0;
+static __thread int           n_paused __attribute__((tls_model("initial-exec"))) = 0;
+
+static inline void record()
+{
+    if (n_paused == 0) ++n_allocs;
+}
+
+extern "C"
+{
+    void *malloc(size_t size)
+    {
+        record();
+        return __libc_malloc(size);
+    }
+
+    void *calloc(size_t n, size_t size)
+    {
+        record();
+        return __libc_calloc(n, size);
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        record();
+        return __libc_realloc(ptr, size);
+    }
+
+    void *memalign(size_t align, size_t size)
+    {
+        record();
+        return __libc_memalign(align, size);
+    }
+
+    int posix_memalign(void **ptr, size_t align, size_t size)
+    {
+        record();
+        *ptr = __libc_memalign(align, size);
+        return *ptr == NULL ? 12 /* ENOMEM */ : 0;
+    }
+
+    void free(void *ptr)
+    {
+        __libc_free(ptr);
+    }
+}
+
+unsigned long alloc_audit::count() { return n_allocs; }
+void          alloc_audit::pause() { ++n_paused;      }
+void          alloc_audit::resume(){ --n_paused;      }
+
+bool alloc_audit::Loop::tick()
+{
+    unsigned long now = count();
+    unsigned long n   = now - last;
+    last = now;
+
+    if (++ticks <= warmup || n == 0) return true;
+
+    alloc_audit::Pause p;
+    ROS_FATAL("[alloc_audit] %s: %lu heap allocation(s) in tick %i after warm-up",
+                                                               name, n, ticks);
+    abort();
+    return false;
+}
+
+#else
+
+bool alloc_audit::Loop::tick()
+{
+    return true;
+}
+
+#endif
@@ -1,7 +1,12 @@
 #include "baxter_interface/arm_ctrl.h"
+#include "baxter_interface/alloc_audit.h"
+#include "baxter_interface/motion_profile.h"
 #include "baxter_control/ArmPos.h"
 #include <pthread.h>
 #include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
 
 using namespace std;
 using namespace geometry_msgs;
@@ -9,12 +14,50 @@ using namespace baxter_core_msgs;
 
 #define MOVE "move"
 
+// Max number of ticks recorded for the motion library, and the min time
+// between them whatever the loop rate (i.e. ~40s of motion) [s]
+#define MOTION_REC_TICKS    4096
+#define MOTION_REC_DT       0.01
+
+// Motions may last this times their expected duration, plus timeout_margin
+#define MOTION_TIMEOUT_FACTOR   1.5
+
+// Progress expected every stall_time from joint-space motions, per meter of
+// Cartesian progress [rad/m], and a conservative joint speed to bound them [rad/s]
+#define JOINT_PROGRESS_SCALE    5.0
+#define HOME_JOINT_SPEED        0.3
+
+// Joint distance to home assumed when the joint states are missing [rad]
+#define HOME_MAX_ERROR          M_PI
+
+// Joint distance at which the retreat moves on to the next waypoint [rad]
+#define RETREAT_WAYPOINT_TOL    0.05
+
+// Relative moves: samples between the IK knots, max deviation of the joint
+// interpolation from the path [m], max joint change per sample [rad], and
+// orientation tolerance at the end of moves that rotate [rad]
+#define PATH_IK_STEP            8
+#define PATH_FK_TOLERANCE       0.002
+#define PATH_MAX_JOINT_STEP     0.1
+#define PATH_ORI_TOLERANCE      0.05
+
+// Max joint setpoints per trajectory message (as the lookahead_k parameter)
+#define LOOKAHEAD_MAX_POINTS    100
+
 ArmCtrl::ArmCtrl(string _name, string _limb, bool _no_robot) :
                  RobotInterface(_name, _limb, _no_robot),
-                 action(""), sub_state("")
+                 action(""), sub_state(""), state_ready(false), settle_time(1000),
+                 recovery_time_home(100), recovery_time_retreat(100)
 {
     update_flag = 0;
     reached_flag = 1;
+    preempt_flag = false;
+    marker_id = -1;
+    external_control = false;
+    external_ack     = false;
+    reconf_server = NULL;
+    state_msg.state.reserve(32);
+    state_msg.action.reserve(32);
     setHomeConf( 0.0717, -1.0009, 1.1083, 1.5520,
                          -0.5235, 1.3468, 0.4464);
     std::string topic = "/"+getName()+"/state_"+_limb;
@@ -27,18 +70,147 @@ ArmCtrl::ArmCtrl(string _name, string _limb, bool _no_robot) :
     control_topic = _n.subscribe(topic, 1, &ArmCtrl::updateDesiredPoseCb, this);
     ROS_INFO("[%s] Created service server with name  : %s", getLimb().c_str(), topic.c_str());
 
+    has_desired_ori    = false;
+    for (int i = 0; i < TARGET_SOURCES; ++i)
+    {
+        last_target_seq[i] = 0;
+        got_target_seq[i]  = false;
+    }
+    n_stale_targets    = 0;
+    n_rejected_targets = 0;
+    _n.param<double>("max_target_age", max_target_age, 0.5);
+
+    topic = "/"+getName()+"/target_stamped_"+_limb;
+    control_topic_stamped = _n.subscribe(topic, 1, &ArmCtrl::updateDesiredPoseStampedCb, this);
+    ROS_INFO("[%s] Created stamped target subscriber : %s", getLimb().c_str(), topic.c_str());
+
+    // Resolved-rate control only needs the (compile-time specialized) Jacobian.
+    // Twists are at the end of the hand, plus the offset of the tool if any
+    double tool_offset = 0.0;
+    _n.param<double>("tool_offset", tool_offset, 0.0);
+    resolved_rate = new ResolvedRate(getLimb(), tool_offset);
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_state);
+        state_w = RobotState();     // value-initialized: no pose, no joints
+        robot_state.store(state_w);
+    }
+
+    joint_vel_cmd.mode = baxter_core_msgs::JointCommand::VELOCITY_MODE;
+    const char *jnts[BAXTER_NUM_JOINTS] = {"_s0", "_s1", "_e0", "_e1", "_w0", "_w1", "_w2"};
+    for (int i = 0; i < BAXTER_NUM_JOINTS; ++i)
+    {
+        joint_vel_cmd.names.push_back(getLimb() + jnts[i]);
+    }
+    joint_vel_cmd.command.resize(BAXTER_NUM_JOINTS, 0.0);
+
+    // The snapshot and the joint names are set: the callbacks can update it
+    state_ready = true;
+
+    topic = "/robot/limb/"+getLimb()+"/joint_command";
+    joint_vel_pub = _n.advertise<baxter_core_msgs::JointCommand>(topic, 1);
+
+    traj_msg.joint_names = joint_vel_cmd.names;
+    traj_msg.points.reserve(LOOKAHEAD_MAX_POINTS);
+
+    topic = "/"+getName()+"/joint_trajectory_"+_limb;
+    _n.param<std::string>("trajectory_topic", topic, topic);
+    traj_pub = _n.advertise<trajectory_msgs::JointTrajectory>(topic, 1);
+    ROS_INFO("[%s] Created trajectory publisher       : %s", getLimb().c_str(), topic.c_str());
+
+    topic = "/"+getName()+"/twist_"+_limb;
+    twist_sub = _n.subscribe(topic, 1, &ArmCtrl::twistCb, this);
+    ROS_INFO("[%s] Created twist subscriber with name : %s", getLimb().c_str(), topic.c_str());
+
     topic = "/"+getName()+"/service_"+_limb+"_to_"+other_limb;
     service_other_limb = _n.advertiseService(topic, &ArmCtrl::serviceOtherLimbCb,this);
     ROS_INFO("[%s] Created service server with name  : %s", getLimb().c_str(), topic.c_str());
 
+    n_running_actions = 0;
+    _n.param<bool>("telemetry", use_telemetry, true);
+    if (use_telemetry)
+    {
+        topic = telemetryShmName(getName(), getLimb());
+        if (telemetry.open(topic))
+        {
+            ROS_INFO("[%s] Created telemetry ring with name  : %s", getLimb().c_str(), topic.c_str());
+        }
+        else
+        {
+            ROS_WARN("[%s] Unable to create telemetry ring %s", getLimb().c_str(), topic.c_str());
+        }
+    }
+
+    // Defaults, overridden by the reconfigure server as soon as it starts
+    ArmParams p;
+    p.arm_speed         = ARM_SPEED;
+    p.arm_accel         = 0.0;
+    p.loop_rate         = 100.0;
+    p.pos_tolerance     = 0.0;
+    p.twist_timeout     = 0.1;
+    p.internal_recovery = true;
+    p.recovery_mode     = RECOVERY_RETREAT;
+    p.retreat_distance  = 0.1;
+    p.stall_time        = 1.0;
+    p.min_progress      = 0.002;
+    p.timeout_margin    = 2.0;
+    p.lookahead_k       = 0;
+    p.command_rate      = 20.0;
+    _n.param<bool>("internal_recovery", p.internal_recovery, true);
+    params.store(p);
+
+    // Seed the reconfigure namespace with the legacy values,
+    // unless they have been set explicitly
+    ros::NodeHandle reconf_n("/"+getName()+"/"+getLimb());
+    if (!reconf_n.hasParam("arm_speed"))
+    {
+        reconf_n.setParam("arm_speed", double(ARM_SPEED));
+    }
+    if (!reconf_n.hasParam("internal_recovery"))
+    {
+        reconf_n.setParam("internal_recovery", p.internal_recovery);
+    }
+    reconf_server = new dynamic_reconfigure::Server<baxter_control::ArmCtrlConfig>(reconf_n);
+    reconf_server->setCallback(boost::bind(&ArmCtrl::reconfigureCb, this, _1, _2));
+    ROS_INFO("[%s] Created reconfigure server in     : %s", getLimb().c_str(),
+                                               reconf_n.getNamespace().c_str());
+
+    retreat_path.resize(1024);
+    retreat_len.resize(1024, 0.0);
+
+    fk_x.resize(PATH_IK_STEP + 1, 0.0);
+    fk_y.resize(PATH_IK_STEP + 1, 0.0);
+    fk_z.resize(PATH_IK_STEP + 1, 0.0);
+
+    for (int i = 0; i < 5; ++i)     n_motion_outcomes[i] = 0;
+
+    // Both limbs (and every restart) share the same library file
+    std::string lib_path = "";
+    if      (getenv("ROS_HOME")) lib_path = std::string(getenv("ROS_HOME")) + "/baxter_motion_library.bin";
+    else if (getenv("HOME"))     lib_path = std::string(getenv("HOME")) + "/.ros/baxter_motion_library.bin";
+    _n.param<std::string>("motion_library", lib_path, lib_path);
+    rec_s.resize(MOTION_REC_TICKS);
+    rec_q.resize(MOTION_REC_TICKS * BAXTER_NUM_JOINTS);
+    rec_n = 0;
+    rec_t = 0.0;
+    replay_q.resize(BAXTER_NUM_JOINTS, 0.0);
+    if (lib_path != "")
+    {
+        if (motion_lib.open(lib_path))
+        {
+            ROS_INFO("[%s] Opened motion library             : %s", getLimb().c_str(), lib_path.c_str());
+        }
+        else
+        {
+            ROS_WARN("[%s] Unable to open motion library %s", getLimb().c_str(), lib_path.c_str());
+        }
+    }
+
     insertAction(ACTION_HOME,    &ArmCtrl::goHome);
     // insertAction(ACTION_RELEASE, &ArmCtrl::releaseObject);
     insertAction(MOVE,      &ArmCtrl::movePose);
     callAction(ACTION_HOME);
 
-    _n.param<bool>("internal_recovery",  internal_recovery, true);
-    ROS_INFO("[%s] Internal_recovery flag set to %s", getLimb().c_str(),
-                                internal_recovery==true?"true":"false");
     ROS_INFO("Starting thread to capture direction data.");
     startInternalThread();
 
@@ -86,21 +258,55 @@ ArmCtrl::ArmCtrl(string _name, string _limb, bool _no_robot) :
 //     return;
 // }
 
+void ArmCtrl::reconfigureCb(baxter_control::ArmCtrlConfig &config, uint32_t level)
+{
+    ArmParams p;
+    p.arm_speed         = config.arm_speed;
+    p.arm_accel         = config.arm_accel;
+    p.loop_rate         = config.loop_rate;
+    p.pos_tolerance     = config.pos_tolerance;
+    p.twist_timeout     = config.twist_timeout;
+    p.internal_recovery = config.internal_recovery;
+    p.recovery_mode     = config.recovery_mode;
+    p.retreat_distance  = config.retreat_distance;
+    p.stall_time        = config.stall_time;
+    p.min_progress      = config.min_progress;
+    p.timeout_margin    = config.timeout_margin;
+    p.lookahead_k       = config.lookahead_k;
+    p.command_rate      = config.command_rate;
+    params.store(p);
+
+    ROS_INFO("[%s] Parameters: speed %g accel %g rate %g tolerance %g recovery %s",
+             getLimb().c_str(), p.arm_speed, p.arm_accel, p.loop_rate,
+             p.pos_tolerance, p.internal_recovery==true?"true":"false");
+}
+
+void ArmCtrl::adaptRate(ros::Rate &r, double &hz, const ArmParams &p)
+{
+    if (p.loop_rate != hz)
+    {
+        hz = p.loop_rate;
+        r  = ros::Rate(hz);
+    }
+}
+
 float ArmCtrl::ComputeStepSize(float start, float finish, float frequency) {
     float dist = finish - start;
-    ROS_INFO("dist: %f, pickup speed: %f", dist, ARM_SPEED);
-    float _time = dist / ARM_SPEED;
+    float speed = getParams().arm_speed;
+    ROS_INFO("dist: %f, pickup speed: %f", dist, speed);
+    float _time = dist / speed;
     // ROS_INFO("_time: %f", time);
     float num_steps = _time * frequency;
     ROS_INFO("num_steps: %f", num_steps);
     return dist / num_steps;
 }
 
-float ArmCtrl::vector_norm(geometry_msgs::Point x) {
+float ArmCtrl::vector_norm(const geometry_msgs::Point &x) {
     return sqrt((x.x * x.x) + (x.y * x.y) + (x.z * x.z));
 }
 
-geometry_msgs::Point ArmCtrl::vector_difference(geometry_msgs::Point x0, geometry_msgs::Point x1) {
+geometry_msgs::Point ArmCtrl::vector_difference(const geometry_msgs::Point &x0,
+                                                const geometry_msgs::Point &x1) {
     geometry_msgs::Point difference;
     difference.x = x1.x - x0.x;
     difference.y = x1.y - x0.y;
@@ -111,7 +317,6 @@ geometry_msgs::Point ArmCtrl::vector_difference(geometry_msgs::Point x0, geometr
 void ArmCtrl::InternalThreadEntry()
 {
     pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS,NULL);
-    _n.param<bool>("internal_recovery",  internal_recovery, true);
     geometry_msgs::Point desiredPos;
     geometry_msgs::Point currPos;
     geometry_msgs::Point difference;
@@ -124,56 +329,154 @@ void ArmCtrl::InternalThreadEntry()
     float pz;
     float norm;
     ros::Time start_time;
-    float time_to_dest;
-    ros::Rate r(100);
+    ros::Time target_stamp;
+    bool twist_active = false;
+    ArmParams p = getParams();
+    // Speed and acceleration are latched at the start of each motion
+    double speed = p.arm_speed;
+    double accel = p.arm_accel;
+    double rate_hz = p.loop_rate;
+    ros::Rate r(rate_hz);
     ros::Duration(0.5).sleep();
-    ori = getOri();
+    RobotState rs = getRobotState();
+    ori = stateOri(rs);
     int i = 0;
-    currPos = getPos();
+    currPos = statePos(rs);
     ROS_INFO("sqrt 4:%f sqrt 5: %f", sqrt(4), sqrt(5));
     ROS_INFO("curr x:%f curr y:%f curr z:%f", currPos.x, currPos.y, currPos.z);
+    alloc_audit::Loop audit("InternalThreadEntry");
     while (RobotInterface::ok()) {
-        if (!reached_flag) {
+        p = getParams();
+        adaptRate(r, rate_hz, p);
+        if (external_control) {
+            // Handover acknowledged: nothing is commanded from this thread
+            // until control is taken back
+            external_ack = true;
+        }
+        else if (!reached_flag && !external_control) {
             desiredPos = getDesiredPos();
-            while (RobotInterface::ok() && !isPositionReached(desiredPos.x, desiredPos.y, desiredPos.z)) {
+            ConvergenceMonitor conv = makeConvergenceMonitor(p);
+            ConvergenceMonitor::Status outcome = ConvergenceMonitor::CONVERGING;
+            conv.reset(ros::Time::now().toSec(), 0.0, 0.0);
+            bool preempted = false;
+            while (RobotInterface::ok() && !external_control) {
+                if (preempt_flag) {
+                    // Left as is: neither reached, nor failed
+                    preempt_flag = false;
+                    preempted    = true;
+                    break;
+                }
+                ros::Time t_tick = ros::Time::now();
+                p = getParams();
+                adaptRate(r, rate_hz, p);
+                // One state sample for the whole tick
+                rs = getRobotState();
                 desiredPos = getDesiredPos();
-                currPos = getPos();
+                if (isPoseReached(rs, desiredPos, POS_MODE_LOOSE)) {
+                    outcome = ConvergenceMonitor::REACHED;
+                    break;
+                }
+                currPos = statePos(rs);
                 if (update_flag) {
-                    ROS_INFO("We've got a new desired position!!!!!!!!!!!!!");
+                    ROS_DEBUG("We've got a new desired position!");
                     start_time = ros::Time::now();
                     start_x = currPos.x;
                     start_y = currPos.y;
                     start_z = currPos.z;
                     difference = vector_difference(currPos, desiredPos);
                     norm = vector_norm(difference);
-                    time_to_dest = norm / ARM_SPEED;
+                    speed = p.arm_speed;
+                    accel = p.arm_accel;
+                    target_stamp = _desired_stamp;
+                    // Position-only targets hold the current orientation
+                    ori = has_desired_ori ? _desired_ori : stateOri(rs);
                     update_flag = 0;
+                    conv = makeConvergenceMonitor(p);
+                    conv.reset(start_time.toSec(), norm,
+                               motion_profile::duration(norm, speed, accel));
                 }
                 double t_elap = (ros::Time::now() - start_time).toSec();
-                if (t_elap < time_to_dest) {
-                    px = start_x + (difference.x / norm)  * ARM_SPEED * t_elap;
-                    py = start_y + (difference.y / norm)  * ARM_SPEED * t_elap;
-                    pz = start_z + (difference.z / norm)  * ARM_SPEED * t_elap;
+                double s      = motion_profile::position(t_elap, norm, speed, accel);
+                // A target that can not be reached is given up, so that newer work can proceed
+                outcome = conv.update(t_tick.toSec(), vector_norm(vector_difference(currPos, desiredPos)),
+                                      max(norm - s, 0.0));
+                if (outcome != ConvergenceMonitor::CONVERGING) break;
+                if (s < norm) {
+                    px = start_x + (difference.x / norm)  * s;
+                    py = start_y + (difference.y / norm)  * s;
+                    pz = start_z + (difference.z / norm)  * s;
                 } else {
                     px = desiredPos.x;
                     py = desiredPos.y;
                     pz = desiredPos.z;
                 }
 
-                ROS_INFO_THROTTLE(0.5,"curr x:%f curr y:%f curr z:%f", currPos.x, currPos.y, currPos.z);
-                ROS_INFO_THROTTLE(0.5,"px:%f py:%f pz:%f", px, py, pz);
-                ROS_INFO_THROTTLE(0.5,"desired x:%f desired y:%f desired z:%f", desiredPos.x, desiredPos.y, desiredPos.z);
-                ROS_INFO_THROTTLE(0.5,"update flag:%i", update_flag);
+                // Debug level only: emitting a log line allocates inside rosconsole
+                ROS_DEBUG_THROTTLE(0.5,"curr x:%f curr y:%f curr z:%f", currPos.x, currPos.y, currPos.z);
+                ROS_DEBUG_THROTTLE(0.5,"px:%f py:%f pz:%f", px, py, pz);
+                ROS_DEBUG_THROTTLE(0.5,"desired x:%f desired y:%f desired z:%f", desiredPos.x, desiredPos.y, desiredPos.z);
 
-                goToPoseNoCheck(px, py, pz, ori.x, ori.y, ori.z, ori.w);
+                {
+                    // IK and command serialization allocate inside RobotInterface/roscpp
+                    alloc_audit::Pause ap;
+                    goToPoseNoCheck(px, py, pz, ori.x, ori.y, ori.z, ori.w);
+                }
+                if (!target_stamp.isZero()) {
+                    // First command for a stamped target: perception-to-command latency
+                    target_latency.add((ros::Time::now() - target_stamp).toSec());
+                    target_stamp = ros::Time();
+                    if (target_latency.getTotal() % 100 == 0) {
+                        alloc_audit::Pause ap;
+                        ROS_INFO("[%s] Target latency: %s. Dropped %lu stale, %lu out of order",
+                                 getLimb().c_str(), target_latency.toString().c_str(),
+                                 n_stale_targets, n_rejected_targets);
+                    }
+                }
+                Point cmdPos;
+                cmdPos.x = px;
+                cmdPos.y = py;
+                cmdPos.z = pz;
+                publishTelemetry(rs, cmdPos, ori, desiredPos, t_tick);
                 ++i;
+                audit.tick();
                 r.sleep();
             }
-            ROS_INFO("POSITION REACHED!!");
-            ROS_INFO("curr x:%f curr y:%f curr z:%f", currPos.x, currPos.y, currPos.z);
-            ROS_INFO("desired x:%f desired y:%f desired z:%f", desiredPos.x, desiredPos.y, desiredPos.z);
+            if (outcome != ConvergenceMonitor::CONVERGING) {
+                rs = getRobotState();
+                reportMotion("target", conv, outcome,
+                             vector_norm(vector_difference(statePos(rs), desiredPos)));
+            }
+            if (outcome == ConvergenceMonitor::REACHED) {
+                joint_history.markSafe();
+                // Once per target, and logging allocates inside rosconsole
+                alloc_audit::Pause ap;
+                ROS_INFO("POSITION REACHED!!");
+                ROS_INFO("curr x:%f curr y:%f curr z:%f", currPos.x, currPos.y, currPos.z);
+                ROS_INFO("desired x:%f desired y:%f desired z:%f", desiredPos.x, desiredPos.y, desiredPos.z);
+            }
+            if (preempted) {
+                alloc_audit::Pause ap;
+                ROS_INFO("[%s] Target preempted by a twist command", getLimb().c_str());
+            }
             reached_flag = 1;
         }
+        else if (!external_control && twistTick(p, twist_active))
+        {
+            // Velocity mode: the command has been sent by twistTick
+        }
+        else if (!external_control)
+        {
+            // Idle: keep monitors fed with the measured pose,
+            // unless an action loop is already doing so
+            if (n_running_actions == 0) {
+                rs = getRobotState();
+                currPos = statePos(rs);
+                publishTelemetry(rs, currPos, stateOri(rs), currPos, ros::Time::now());
+            }
+        }
+        // The idle and twist ticks are audited as well, and so is
+        // whatever happened since the end of the last target
+        audit.tick();
         r.sleep();
     }
     closeInternalThread();
@@ -182,7 +485,7 @@ void ArmCtrl::InternalThreadEntry()
 
 geometry_msgs::Point ArmCtrl::getDesiredPos() {
     if (reached_flag) {
-        return getPos();
+        return statePos(getRobotState());
     }
     return _desired_pos;
 }
@@ -243,13 +546,325 @@ geometry_msgs::Point ArmCtrl::getDesiredPos() {
 //     return;
 // }
 
+void ArmCtrl::setExternalControl(bool _ext)
+{
+    std::lock_guard<std::mutex> lck(mtx_target);
+
+    // Hold the current pose until a new target arrives
+    _desired_pos    = statePos(getRobotState());
+    _desired_stamp  = ros::Time();
+    has_desired_ori = false;
+    update_flag  = 0;
+    reached_flag = 1;
+
+    external_ack     = false;
+    external_control = _ext;
+}
+
+bool ArmCtrl::waitExternalControl(double timeout)
+{
+    ros::WallTime t_end = ros::WallTime::now() + ros::WallDuration(timeout);
+
+    while (!external_ack)
+    {
+        if (!external_control || ros::WallTime::now() > t_end)  return false;
+        ros::WallDuration(0.001).sleep();
+    }
+
+    return true;
+}
+
+bool ArmCtrl::sendPoseCommand(const Point &p, const Quaternion &o)
+{
+    return goToPoseNoCheck(p.x, p.y, p.z, o.x, o.y, o.z, o.w);
+}
+
+bool ArmCtrl::isPoseReached(const Point &p, string mode)
+{
+    return isPoseReached(getRobotState(), p, mode);
+}
+
+bool ArmCtrl::isPoseReached(const RobotState &rs, const Point &p, const string &mode)
+{
+    return isPoseReached(rs, p, toleranceMode(mode));
+}
+
+int ArmCtrl::toleranceMode(const string &mode)
+{
+    if      (mode == "strict")  return POS_MODE_STRICT;
+    else if (mode == "loose")   return POS_MODE_LOOSE;
+
+    return POS_MODE_INVALID;
+}
+
+bool ArmCtrl::isPoseReached(const RobotState &rs, const Point &p, int mode)
+{
+    double dx = p.x - rs.pos[0];
+    double dy = p.y - rs.pos[1];
+    double dz = p.z - rs.pos[2];
+
+    double tol = getParams().pos_tolerance;
+    if (tol > 0.0)  return sqrt(dx*dx + dy*dy + dz*dz) < tol;
+
+    if      (mode == POS_MODE_STRICT)   tol = POS_TOL_STRICT;
+    else if (mode == POS_MODE_LOOSE)    tol = POS_TOL_LOOSE;
+    else                                return false;
+
+    return fabs(dx) <= tol && fabs(dy) <= tol && fabs(dz) <= tol;
+}
+
 void ArmCtrl::updateDesiredPoseCb(const baxter_control::ArmPos::ConstPtr& msg)
 {
-    reached_flag = 0;
-    update_flag = 1;
+    std::lock_guard<std::mutex> lck(mtx_target);
+
+    if (external_control)
+    {
+        ROS_WARN_THROTTLE(1.0, "[%s] Ignoring target: the arm is under external control",
+                                                                     getLimb().c_str());
+        return;
+    }
+
     _desired_pos.x    = msg->xpos;
     _desired_pos.y    = msg->ypos;
     _desired_pos.z    = msg->zpos;
+    _desired_stamp    = ros::Time();
+    has_desired_ori   = false;
+    preempt_flag = false;
+    reached_flag = 0;
+    update_flag = 1;
+}
+
+void ArmCtrl::updateDesiredPoseStampedCb(const baxter_control::ArmPosStamped::ConstPtr& msg)
+{
+    setDesiredPoseStamped(*msg);
+}
+
+bool ArmCtrl::setDesiredPoseStamped(const baxter_control::ArmPosStamped &msg, int src)
+{
+    std::lock_guard<std::mutex> lck(mtx_target);
+
+    if (external_control)
+    {
+        ROS_WARN_THROTTLE(1.0, "[%s] Ignoring target: the arm is under external control",
+                                                                     getLimb().c_str());
+        return false;
+    }
+
+    ros::Time now = ros::Time::now();
+    double    age = (now - msg.header.stamp).toSec();
+
+    if (age > max_target_age)
+    {
+        ++n_stale_targets;
+        ROS_WARN_THROTTLE(1.0, "[%s] Dropping stale target %lu (%g s old)",
+                 getLimb().c_str(), (unsigned long)msg.sequence, age);
+        return false;
+    }
+
+    // The source restarted (and counts from scratch) if its numbering
+    // went back in time while its stamps kept going forward
+    if (got_target_seq[src] && msg.sequence < last_target_seq[src] &&
+                               msg.header.stamp > last_target_stamp[src])
+    {
+        ROS_WARN("[%s] Target sequence restarted from %lu to %lu", getLimb().c_str(),
+                 (unsigned long)last_target_seq[src], (unsigned long)msg.sequence);
+        got_target_seq[src] = false;
+    }
+
+    if (got_target_seq[src] && msg.sequence <= last_target_seq[src])
+    {
+        ++n_rejected_targets;
+        ROS_WARN_THROTTLE(1.0, "[%s] Rejecting out-of-order target %lu (last %lu)",
+                 getLimb().c_str(), (unsigned long)msg.sequence,
+                                    (unsigned long)last_target_seq[src]);
+        return false;
+    }
+
+    last_target_seq[src]   = msg.sequence;
+    last_target_stamp[src] = msg.header.stamp;
+    got_target_seq[src]    = true;
+
+    _desired_pos = msg.pose.position;
+
+    // Extrapolate moving targets over the time it took them to get here
+    if (msg.has_velocity && age > 0.0)
+    {
+        _desired_pos.x += msg.velocity.x * age;
+        _desired_pos.y += msg.velocity.y * age;
+        _desired_pos.z += msg.velocity.z * age;
+    }
+
+    _desired_ori    = msg.pose.orientation;
+    has_desired_ori = true;
+    _desired_stamp  = msg.header.stamp;
+    preempt_flag = false;
+    reached_flag = 0;
+    update_flag = 1;
+    return true;
+}
+
+void ArmCtrl::setObjectPose(int id, const geometry_msgs::PoseStamped &pose)
+{
+    std::lock_guard<std::mutex> lck(mtx_object_cache);
+    object_cache[id] = pose;
+}
+
+bool ArmCtrl::getObjectPose(int id, geometry_msgs::PoseStamped &pose)
+{
+    std::lock_guard<std::mutex> lck(mtx_object_cache);
+
+    std::map<int, geometry_msgs::PoseStamped>::iterator it = object_cache.find(id);
+    if (it == object_cache.end())   return false;
+
+    pose = it->second;
+    return true;
+}
+
+void ArmCtrl::twistCb(const geometry_msgs::Twist::ConstPtr& msg)
+{
+    TwistCmd cmd;
+    cmd.v[0]  = msg->linear.x;
+    cmd.v[1]  = msg->linear.y;
+    cmd.v[2]  = msg->linear.z;
+    cmd.v[3]  = msg->angular.x;
+    cmd.v[4]  = msg->angular.y;
+    cmd.v[5]  = msg->angular.z;
+    cmd.stamp = ros::Time::now();
+    twist_cmd.store(cmd);
+
+    // A velocity command preempts any position target (see InternalThreadEntry)
+    preempt_flag = true;
+}
+
+void ArmCtrl::jointStatesCb(const sensor_msgs::JointState& msg)
+{
+    RobotInterface::jointStatesCb(msg);
+    if (!state_ready)   return;
+
+    double q[BAXTER_NUM_JOINTS];
+    int found = 0;
+
+    for (size_t i = 0; i < msg.name.size() && i < msg.position.size(); ++i)
+    {
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+        {
+            if (msg.name[i] == joint_vel_cmd.names[j])
+            {
+                q[j] = msg.position[i];
+                ++found;
+                break;
+            }
+        }
+    }
+
+    // Baxter also publishes messages with the gripper joints only
+    if (found != BAXTER_NUM_JOINTS)     return;
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_state);
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     state_w.q[j] = q[j];
+        state_w.has_joints   = true;
+        state_w.joints_stamp = msg.header.stamp;
+        robot_state.store(state_w);
+    }
+
+    joint_history.push(q);
+}
+
+void ArmCtrl::endpointCb(const baxter_core_msgs::EndpointState& msg)
+{
+    RobotInterface::endpointCb(msg);
+    if (!state_ready)   return;
+
+    std::lock_guard<std::mutex> lck(mtx_state);
+
+    state_w.pos[0]     = msg.pose.position.x;
+    state_w.pos[1]     = msg.pose.position.y;
+    state_w.pos[2]     = msg.pose.position.z;
+    state_w.ori[0]     = msg.pose.orientation.x;
+    state_w.ori[1]     = msg.pose.orientation.y;
+    state_w.ori[2]     = msg.pose.orientation.z;
+    state_w.ori[3]     = msg.pose.orientation.w;
+    state_w.has_pose   = true;
+    state_w.pose_stamp = msg.header.stamp;
+    robot_state.store(state_w);
+}
+
+RobotState ArmCtrl::getRobotState()
+{
+    RobotState rs = robot_state.load();
+
+    if (!rs.has_pose)
+    {
+        Point      pos = getPos();
+        Quaternion ori = getOri();
+        rs.pos[0] = pos.x;  rs.pos[1] = pos.y;  rs.pos[2] = pos.z;
+        rs.ori[0] = ori.x;  rs.ori[1] = ori.y;  rs.ori[2] = ori.z;  rs.ori[3] = ori.w;
+    }
+
+    return rs;
+}
+
+Point ArmCtrl::statePos(const RobotState &rs)
+{
+    Point p;
+    p.x = rs.pos[0];
+    p.y = rs.pos[1];
+    p.z = rs.pos[2];
+    return p;
+}
+
+Quaternion ArmCtrl::stateOri(const RobotState &rs)
+{
+    Quaternion o;
+    o.x = rs.ori[0];
+    o.y = rs.ori[1];
+    o.z = rs.ori[2];
+    o.w = rs.ori[3];
+    return o;
+}
+
+bool ArmCtrl::twistTick(const ArmParams &p, bool &active)
+{
+    TwistCmd cmd = twist_cmd.load();
+    bool   fresh = !cmd.stamp.isZero() &&
+                   (ros::Time::now() - cmd.stamp).toSec() < p.twist_timeout;
+
+    if (!fresh)
+    {
+        if (active)
+        {
+            double zero[BAXTER_NUM_JOINTS] = {0.0};
+            publishJointVelocities(zero);
+
+            alloc_audit::Pause ap;
+            ROS_INFO("[%s] Twist stream stopped", getLimb().c_str());
+            active = false;
+        }
+        return false;
+    }
+
+    RobotState rs = robot_state.load();
+    if (!rs.has_joints || resolved_rate == NULL)    return false;
+
+    double qdot[BAXTER_NUM_JOINTS];
+    if (!resolved_rate->computeJointVelocities(rs.q, cmd.v, qdot))   return false;
+
+    publishJointVelocities(qdot);
+    active = true;
+
+    return true;
+}
+
+void ArmCtrl::publishJointVelocities(const double qdot[BAXTER_NUM_JOINTS])
+{
+    for (int i = 0; i < BAXTER_NUM_JOINTS; ++i)
+    {
+        joint_vel_cmd.command[i] = qdot[i];
+    }
+
+    alloc_audit::Pause ap;
+    joint_vel_pub.publish(joint_vel_cmd);
 }
 
 bool ArmCtrl::serviceOtherLimbCb(baxter_control::DoAction::Request  &req,
@@ -359,7 +974,12 @@ bool ArmCtrl::callAction(const std::string &a)
     if (isActionInDB(a)) // The action is in the db
     {
         f_action act = action_db[a];
-        return (this->*act)();
+
+        ++n_running_actions;
+        bool res = (this->*act)();
+        --n_running_actions;
+
+        return res;
     }
 
     return false;
@@ -424,94 +1044,518 @@ bool ArmCtrl::movePose()
 
 bool ArmCtrl::moveArm(string dir, double dist, string mode, bool disable_coll_av)
 {
-    Point start = getPos();
-    Point final = getPos();
+    double dp[3]   = {0.0, 0.0, 0.0};
+    double drot[3] = {0.0, 0.0, 0.0};
+
+    if      (dir == "backward") dp[0] = -dist;
+    else if (dir == "forward")  dp[0] = +dist;
+    else if (dir == "right")    dp[1] = -dist;
+    else if (dir == "left")     dp[1] = +dist;
+    else if (dir == "down")     dp[2] = -dist;
+    else if (dir == "up")       dp[2] = +dist;
+    else                               return false;
 
-    Quaternion ori = getOri();
+    return moveArmRelative(dp, drot, mode, disable_coll_av);
+}
 
-    if      (dir == "backward") final.x -= dist;
-    else if (dir == "forward")  final.x += dist;
-    else if (dir == "right")    final.y -= dist;
-    else if (dir == "left")     final.y += dist;
-    else if (dir == "down")     final.z -= dist;
-    else if (dir == "up")       final.z += dist;
-    else                               return false;
+/**
+ * Angle between the measured orientation and a given one [rad]
+ */
+static double oriError(const RobotState &rs, const double o[4])
+{
+    double dot = fabs(rs.ori[0]*o[0] + rs.ori[1]*o[1] + rs.ori[2]*o[2] + rs.ori[3]*o[3]);
+    return 2.0 * acos(min(dot, 1.0));
+}
+
+bool ArmCtrl::moveArmRelative(const double dp[3], const double drot[3],
+                              string mode, bool disable_coll_av)
+{
+    RobotState rs = getRobotState();
+
+    Point start = statePos(rs);
+    Point final = start;
+
+    Quaternion ori = stateOri(rs);
+
+    final.x += dp[0];
+    final.y += dp[1];
+    final.z += dp[2];
+
+    double dist    = sqrt(dp[0]*dp[0] + dp[1]*dp[1] + dp[2]*dp[2]);
+    bool   rotates = drot[0] != 0.0 || drot[1] != 0.0 || drot[2] != 0.0;
+
+    ArmParams prm   = getParams();
+    double  speed   = prm.arm_speed;
+    double  accel   = prm.arm_accel;
+    double  rate_hz = prm.loop_rate;
+
+    // Replay the motion from the library if it has been done before,
+    // otherwise record it while it is executed (translations only)
+    MotionKey lib_key;
+    bool      lib_use = false;
+    if (motion_lib.isOpen() && rs.has_joints && !rotates)
+    {
+        lib_key = MotionLibrary::makeKey(getLimb(), mode, rs.q, dp);
+        lib_use = true;
+
+        if (motion_lib.lookup(lib_key, lib_traj))
+        {
+            if (isTrajectoryValid(lib_traj, rs.q, dp))
+            {
+                bool res = replayTrajectory(lib_traj, start, final, ori, dist,
+                                                        mode, disable_coll_av);
+                if (res)    motion_lib.recordHit(lib_traj.ik_time);
+                else        motion_lib.recordMiss();
+
+                ROS_INFO("[%s] Motion library: %s", getLimb().c_str(),
+                                    motion_lib.statsToString().c_str());
+                return res;
+            }
+
+            motion_lib.recordInvalid();
+        }
+        else
+        {
+            motion_lib.recordMiss();
+        }
+    }
+
+    // Sample the whole path, and check that it is feasible, before moving
+    double p0[3] = {start.x, start.y, start.z};
+    double o0[4] = {ori.x, ori.y, ori.z, ori.w};
+    if (!path.sample(p0, o0, dp, drot, speed, accel))
+    {
+        ROS_ERROR("[%s] Relative move too long: more than %i samples",
+                                getLimb().c_str(), CARTESIAN_PATH_MAX_SAMPLES);
+        return false;
+    }
+
+    double ik_time = 0.0;
+    if (!solvePathIK(ik_time))
+    {
+        ROS_ERROR("[%s] Relative move not feasible, the arm has not moved", getLimb().c_str());
+        return false;
+    }
+
+    int    tol_mode = toleranceMode(mode);
+    size_t n = path.size();
+    double o_final[4] = {path.qx[n-1], path.qy[n-1], path.qz[n-1], path.qw[n-1]};
+
+    if (lib_use)
+    {
+        rec_n = 0;
+        recordTick(rs, 0.0, 0.0);
+    }
 
     ros::Time t_start = ros::Time::now();
 
-    bool finish = false;
+    // Rotations count towards the distance to the goal as in the path sampling
+    double error = vector_norm(vector_difference(start, final)) +
+                   CARTESIAN_PATH_ROT_RADIUS * oriError(rs, o_final);
+    double error_start = error;
+
+    ConvergenceMonitor conv = makeConvergenceMonitor(prm);
+    conv.reset(t_start.toSec(), error, path.getDuration());
 
-    ros::Rate r(100);
+    // Lookahead mode: the next batch is due when the previous one is
+    ros::Time t_batch = t_start;
+
+    ros::Rate r(rate_hz);
+    alloc_audit::Loop audit("moveArm");
     while(RobotInterface::ok())
     {
-        if (disable_coll_av)    suppressCollisionAv();
+        ros::Time t_tick = ros::Time::now();
+        ArmParams p_tick = getParams();
+        adaptRate(r, rate_hz, p_tick);
+        rs = getRobotState();
+
+        if (disable_coll_av)
+        {
+            alloc_audit::Pause p;
+            suppressCollisionAv();
+        }
 
         double t_elap = (ros::Time::now() - t_start).toSec();
+        double pt[3];
+        double s      = path.jointsAt(t_elap, &replay_q[0], pt);
+
+        // The lookahead batches replace the per-tick joint command, as long
+        // as a streamer is there to execute them
+        int  k        = min(p_tick.lookahead_k, LOOKAHEAD_MAX_POINTS);
+        bool streamed = false;
+        if (k > 0)
+        {
+            alloc_audit::Pause p;
+            streamed = traj_pub.getNumSubscribers() > 0;
+        }
+
+        if (!streamed)
+        {
+            alloc_audit::Pause p;
+            if (!goToJointConfNoCheck(replay_q))    return false;
+        }
+        else if (t_tick >= t_batch)
+        {
+            // A batch never spans less time than the period of the batches
+            double period = min(1.0 / p_tick.command_rate, k * path.getDt());
+            publishLookahead(t_elap, t_start + ros::Duration(t_elap), k);
+            t_batch = t_tick + ros::Duration(period);
+        }
 
-        double px = start.x;
-        double py = start.y;
-        double pz = start.z;
+        double e_ori = oriError(rs, o_final);
+        error = vector_norm(vector_difference(statePos(rs), final)) +
+                CARTESIAN_PATH_ROT_RADIUS * e_ori;
 
-        if (!finish)
+        bool reached = t_elap >= path.getDuration() && isPoseReached(rs, final, tol_mode) &&
+                       (!rotates || e_ori < PATH_ORI_TOLERANCE);
+        if (reached)
         {
-            if (dir == "backward" | dir == "forward")
+            reportMotion("moveArm", conv, ConvergenceMonitor::REACHED, error);
+            joint_history.markSafe();
+            if (lib_use)
             {
-                int sgn = dir=="backward"?-1:+1;
-                px = px + sgn * ARM_SPEED * t_elap;
-
-                if (dir == "backward")
-                {
-                    if (px < final.x) finish = true;
-                }
-                else if (dir == "forward")
-                {
-                    if (px > final.x) finish = true;
-                }
+                recordTick(rs, s, t_elap, true);
+                storeRecordedMotion(lib_key, ik_time);
+                ROS_INFO("[%s] Motion library: %s", getLimb().c_str(),
+                                    motion_lib.statsToString().c_str());
             }
-            if (dir == "right" | dir == "left")
-            {
-                int sgn = dir=="right"?-1:+1;
-                py = py + sgn * ARM_SPEED * t_elap;
+            return true;
+        }
 
-                if (dir == "right")
-                {
-                    if (py < final.y) finish = true;
-                }
-                else if (dir == "left")
-                {
-                    if (py > final.y) finish = true;
-                }
-            }
-            if (dir == "down" | dir == "up")
-            {
-                int sgn = dir=="down"?-1:+1;
-                pz = pz + sgn * ARM_SPEED * t_elap;
+        if (lib_use)    recordTick(rs, s, t_elap);
+
+        size_t i = min(size_t(t_elap / path.getDt()), n - 1);
+        Point      cmd;
+        Quaternion cmd_ori;
+        cmd.x     = pt[0];
+        cmd.y     = pt[1];
+        cmd.z     = pt[2];
+        cmd_ori.x = path.qx[i];
+        cmd_ori.y = path.qy[i];
+        cmd_ori.z = path.qz[i];
+        cmd_ori.w = path.qw[i];
+        publishTelemetry(rs, cmd, cmd_ori, final, t_tick);
+
+        // Escalate (i.e. fail the action) instead of spinning forever
+        ConvergenceMonitor::Status status = conv.update(t_tick.toSec(), error,
+                                                        (1.0 - s) * error_start);
+        if (status != ConvergenceMonitor::CONVERGING)
+        {
+            reportMotion("moveArm", conv, status, error);
+            return false;
+        }
 
-                if (dir == "down")
-                {
-                    if (pz < final.z) finish = true;
-                }
-                else if (dir == "up")
-                {
-                    if (pz > final.z) finish = true;
-                }
-            }
+        audit.tick();
+        r.sleep();
+    }
+
+    return false;
+}
+
+void ArmCtrl::publishLookahead(double t_elap, const ros::Time &stamp, int k)
+{
+    // The points keep their buffers, so only a change of k allocates
+    if (int(traj_msg.points.size()) != k)
+    {
+        alloc_audit::Pause p;
+        traj_msg.points.resize(k);
+        for (int i = 0; i < k; ++i)
+        {
+            traj_msg.points[i].positions.resize(BAXTER_NUM_JOINTS, 0.0);
         }
-        else
+    }
+
+    double dt = path.getDt();
+    for (int i = 0; i < k; ++i)
+    {
+        trajectory_msgs::JointTrajectoryPoint &pnt = traj_msg.points[i];
+        path.jointsAt(t_elap + i * dt, &pnt.positions[0]);
+        pnt.time_from_start = ros::Duration(i * dt);
+    }
+
+    traj_msg.header.stamp = stamp;
+
+    {
+        // Serialization allocates
+        alloc_audit::Pause p;
+        traj_pub.publish(traj_msg);
+    }
+}
+
+bool ArmCtrl::solvePathIK(double &ik_time)
+{
+    size_t n = path.size();
+
+    ik_time = 0.0;
+    if (!solvePathKnot(0, ik_time))     return false;
+
+    for (size_t i0 = 0; i0 + 1 < n; i0 += PATH_IK_STEP)
+    {
+        size_t i1 = min(i0 + PATH_IK_STEP, n - 1);
+
+        if (!solvePathKnot(i1, ik_time))                return false;
+        if (!refinePathSegment(i0, i1, ik_time))        return false;
+    }
+
+    return true;
+}
+
+bool ArmCtrl::solvePathKnot(size_t i, double &ik_time)
+{
+    bool res = false;
+    {
+        // The IK solver allocates internally
+        alloc_audit::Pause p;
+        ros::WallTime t_ik = ros::WallTime::now();
+        res = computeIK(path.x [i], path.y [i], path.z [i],
+                        path.qx[i], path.qy[i], path.qz[i], path.qw[i], ik_sol);
+        ik_time += (ros::WallTime::now() - t_ik).toSec();
+    }
+
+    if (!res || ik_sol.size() < BAXTER_NUM_JOINTS)
+    {
+        ROS_WARN("[%s] No IK for the sample %zu of the path [%g %g %g]", getLimb().c_str(),
+                                                      i, path.x[i], path.y[i], path.z[i]);
+        return false;
+    }
+
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     path.q[j][i] = ik_sol[j];
+    return true;
+}
+
+bool ArmCtrl::refinePathSegment(size_t i0, size_t i1, double &ik_time)
+{
+    // Continuity: the IK may jump to another solution (e.g. elbow up/down)
+    double step = 0.0;
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+    {
+        step = max(step, fabs(path.q[j][i1] - path.q[j][i0]));
+    }
+    bool continuous = step <= PATH_MAX_JOINT_STEP * (i1 - i0);
+
+    if (i1 - i0 <= 1)
+    {
+        if (!continuous)
+        {
+            ROS_WARN("[%s] Discontinuous IK along the path, at sample %zu",
+                                                     getLimb().c_str(), i1);
+        }
+        return continuous;
+    }
+
+    path.interpolateJoints(i0, i1);
+
+    if (continuous)
+    {
+        // Batch FK of the interpolated segment
+        size_t m = i1 - i0 + 1;
+        const double *q[BAXTER_NUM_JOINTS];
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     q[j] = &path.q[j][i0];
+
+        baxter_kinematics::Limb limb = getLimb() == "left" ? baxter_kinematics::LEFT
+                                                           : baxter_kinematics::RIGHT;
+        baxter_kinematics::fkBatch(limb, q, m, &fk_x[0], &fk_y[0], &fk_z[0]);
+
+        // The end-effector of the IK may differ from the one of the FK:
+        // the deviation is measured relative to the offsets at the knots
+        double ox0 = fk_x[0]   - path.x[i0], ox1 = fk_x[m-1] - path.x[i1];
+        double oy0 = fk_y[0]   - path.y[i0], oy1 = fk_y[m-1] - path.y[i1];
+        double oz0 = fk_z[0]   - path.z[i0], oz1 = fk_z[m-1] - path.z[i1];
+
+        double dev = 0.0;
+        for (size_t k = 1; k + 1 < m; ++k)
+        {
+            double w  = double(k) / double(m - 1);
+            double ex = fk_x[k] - path.x[i0 + k] - (ox0 + w * (ox1 - ox0));
+            double ey = fk_y[k] - path.y[i0 + k] - (oy0 + w * (oy1 - oy0));
+            double ez = fk_z[k] - path.z[i0 + k] - (oz0 + w * (oz1 - oz0));
+            dev = max(dev, ex*ex + ey*ey + ez*ez);
+        }
+
+        if (dev <= PATH_FK_TOLERANCE * PATH_FK_TOLERANCE)   return true;
+    }
+
+    size_t mid = (i0 + i1) / 2;
+    return solvePathKnot(mid, ik_time) && refinePathSegment(i0, mid, ik_time)
+                                       && refinePathSegment(mid, i1, ik_time);
+}
+
+void ArmCtrl::recordTick(const RobotState &rs, double s, double t, bool last)
+{
+    if (rec_n >= MOTION_REC_TICKS)  return;
+    if (!rs.has_joints)             return;
+
+    // Decimated to MOTION_REC_DT, so that the length of the motions that can
+    // be recorded does not depend on the loop rate
+    if (!last && rec_n > 0 && t < rec_t + MOTION_REC_DT)  return;
+
+    rec_t        = t;
+    rec_s[rec_n] = s;
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+    {
+        rec_q[rec_n * BAXTER_NUM_JOINTS + j] = rs.q[j];
+    }
+    ++rec_n;
+}
+
+void ArmCtrl::storeRecordedMotion(const MotionKey &key, double ik_time)
+{
+    // The recording overflowed, or missed the joint states
+    if (rec_n >= MOTION_REC_TICKS)
+    {
+        ROS_WARN("[%s] Motion library: motion longer than %gs, not stored",
+                  getLimb().c_str(), MOTION_REC_TICKS * MOTION_REC_DT);
+        return;
+    }
+    if (rec_n < 2)  return;
+
+    // Resample uniformly along the path; the last sample is the
+    // configuration the arm actually settled in
+    int k = 0;
+    for (int i = 0; i < MOTION_LIB_SAMPLES; ++i)
+    {
+        float u = float(i) / (MOTION_LIB_SAMPLES - 1);
+        while (k < rec_n - 1 && rec_s[k] < u)   ++k;
+
+        int   k0 = max(k - 1, 0);
+        float ds = rec_s[k] - rec_s[k0];
+        float  w = ds > 0.0f ? (u - rec_s[k0]) / ds : 1.0f;
+        w = min(max(w, 0.0f), 1.0f);
+
+        if (i == MOTION_LIB_SAMPLES - 1)
+        {
+            k0 = k = rec_n - 1;
+        }
+
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
         {
-            px = final.x;
-            py = final.y;
-            pz = final.z;
+            float q0 = rec_q[k0 * BAXTER_NUM_JOINTS + j];
+            float q1 = rec_q[k  * BAXTER_NUM_JOINTS + j];
+            lib_traj.q[i][j] = q0 + w * (q1 - q0);
         }
+    }
+    lib_traj.ik_time = ik_time;
+
+    motion_lib.store(key, lib_traj);
+}
 
-        double ox = ori.x;
-        double oy = ori.y;
-        double oz = ori.z;
-        double ow = ori.w;
+bool ArmCtrl::isTrajectoryValid(const MotionTrajectory &t, const double q[BAXTER_NUM_JOINTS],
+                                const double goal[3])
+{
+    // The arm must be where the trajectory starts
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+    {
+        if (fabs(t.q[0][j] - q[j]) > MOTION_LIB_Q_STEP)     return false;
+    }
+
+    // Forward kinematics of the whole trajectory at once
+    double qs[BAXTER_NUM_JOINTS][MOTION_LIB_SAMPLES];
+    const double *qp[BAXTER_NUM_JOINTS];
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+    {
+        for (int i = 0; i < MOTION_LIB_SAMPLES; ++i)    qs[j][i] = t.q[i][j];
+        qp[j] = qs[j];
+    }
+
+    double px[MOTION_LIB_SAMPLES], py[MOTION_LIB_SAMPLES], pz[MOTION_LIB_SAMPLES];
+    baxter_kinematics::fkBatch(getLimb() == "left" ? baxter_kinematics::LEFT
+                                                   : baxter_kinematics::RIGHT,
+                               qp, MOTION_LIB_SAMPLES, px, py, pz);
+
+    // Relative displacements are insensitive to the tool offset, since
+    // the orientation is kept constant along the motion
+    double len = sqrt(goal[0]*goal[0] + goal[1]*goal[1] + goal[2]*goal[2]);
+    if (len <= 0.0)     return false;
+
+    for (int i = 0; i < MOTION_LIB_SAMPLES; ++i)
+    {
+        double d[3] = {px[i] - px[0], py[i] - py[0], pz[i] - pz[0]};
+
+        // Distance from the segment between the start and the goal
+        double u = (d[0]*goal[0] + d[1]*goal[1] + d[2]*goal[2]) / (len * len);
+        u = min(max(u, 0.0), 1.0);
+
+        double e[3] = {d[0] - u*goal[0], d[1] - u*goal[1], d[2] - u*goal[2]};
+        if (sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]) > MOTION_LIB_PATH_TOL)   return false;
+    }
+
+    int n = MOTION_LIB_SAMPLES - 1;
+    double e[3] = {px[n] - px[0] - goal[0], py[n] - py[0] - goal[1], pz[n] - pz[0] - goal[2]};
+
+    return sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]) < MOTION_LIB_GOAL_TOL;
+}
+
+bool ArmCtrl::replayTrajectory(const MotionTrajectory &t, const Point &start,
+                               const Point &final, const Quaternion &ori,
+                               double dist, const string &mode, bool disable_coll_av)
+{
+    ArmParams prm   = getParams();
+    double  speed   = prm.arm_speed;
+    double  accel   = prm.arm_accel;
+    double  rate_hz = prm.loop_rate;
 
-        if (!goToPoseNoCheck(px, py, pz, ox, oy, oz, ow))       return false;
-        if (isPositionReached(final.x, final.y, final.z, mode))  return true;
+    int tol_mode = toleranceMode(mode);
 
+    ros::Time t_start = ros::Time::now();
+
+    ConvergenceMonitor conv = makeConvergenceMonitor(prm);
+    conv.reset(t_start.toSec(), dist, motion_profile::duration(dist, speed, accel));
+
+    ros::Rate r(rate_hz);
+    alloc_audit::Loop audit("replayTrajectory");
+    while(RobotInterface::ok())
+    {
+        ros::Time t_tick = ros::Time::now();
+        adaptRate(r, rate_hz, getParams());
+
+        if (disable_coll_av)
+        {
+            alloc_audit::Pause p;
+            suppressCollisionAv();
+        }
+
+        double t_elap = (ros::Time::now() - t_start).toSec();
+        double s      = motion_profile::position(t_elap, dist, speed, accel) / dist;
+
+        // Linear interpolation between the stored samples
+        double x = s * (MOTION_LIB_SAMPLES - 1);
+        int    i = min(int(x), MOTION_LIB_SAMPLES - 2);
+        double w = x - i;
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+        {
+            replay_q[j] = t.q[i][j] + w * (t.q[i+1][j] - t.q[i][j]);
+        }
+
+        RobotState rs = getRobotState();
+        {
+            alloc_audit::Pause p;
+            if (!goToJointConfNoCheck(replay_q))    return false;
+        }
+
+        double error = vector_norm(vector_difference(statePos(rs), final));
+
+        if (isPoseReached(rs, final, tol_mode))
+        {
+            reportMotion("replayTrajectory", conv, ConvergenceMonitor::REACHED, error);
+            joint_history.markSafe();
+            return true;
+        }
+
+        Point cmd;
+        cmd.x = start.x + s * (final.x - start.x);
+        cmd.y = start.y + s * (final.y - start.y);
+        cmd.z = start.z + s * (final.z - start.z);
+        publishTelemetry(rs, cmd, ori, final, t_tick);
+
+        ConvergenceMonitor::Status status = conv.update(t_tick.toSec(), error,
+                                                        max(1.0 - s, 0.0) * dist);
+        if (status != ConvergenceMonitor::CONVERGING)
+        {
+            reportMotion("replayTrajectory", conv, status, error);
+            return false;
+        }
+
+        audit.tick();
         r.sleep();
     }
 
@@ -537,19 +1581,132 @@ bool ArmCtrl::homePoseStrict(bool disable_coll_av)
 {
     ROS_INFO("[%s] Going to home position strict..", getLimb().c_str());
 
-    ros::Rate r(100);
-    while(RobotInterface::ok() && !isConfigurationReached(home_conf))
+    ArmParams prm   = getParams();
+    double  rate_hz = prm.loop_rate;
+
+    // Monitored in joint space if the joint states are available,
+    // otherwise only bounded in time
+    ConvergenceMonitor conv = makeConvergenceMonitor(prm, true);
+    RobotState rs = getRobotState();
+    bool monitored = rs.has_joints;
+    double  error  = rs.has_joints ? homeError(rs) : 0.0;
+    conv.reset(ros::Time::now().toSec(), error,
+               (rs.has_joints ? error : HOME_MAX_ERROR) / HOME_JOINT_SPEED);
+
+    ros::Rate r(rate_hz);
+    alloc_audit::Loop audit("homePoseStrict");
+    while(RobotInterface::ok())
     {
-        if (disable_coll_av)    suppressCollisionAv();
+        ros::Time t_tick = ros::Time::now();
+        adaptRate(r, rate_hz, getParams());
+        rs = getRobotState();
+        if (rs.has_joints)  error = homeError(rs);
+
+        // Checked on the snapshot when possible, instead of going through RobotInterface
+        if (rs.has_joints)
+        {
+            if (error < JOINT_TOLERANCE)    break;
+        }
+        else
+        {
+            alloc_audit::Pause p;
+            if (isConfigurationReached(home_conf))  break;
+        }
+
+        if (disable_coll_av)
+        {
+            alloc_audit::Pause p;
+            suppressCollisionAv();
+        }
+
+        {
+            alloc_audit::Pause p;
+            goToJointConfNoCheck(home_conf);
+        }
+
+        // This is a joint-space move: there is no Cartesian
+        // command, so the measured pose is reported instead
+        Point     pos = statePos(rs);
+        publishTelemetry(rs, pos, stateOri(rs), pos, t_tick);
 
-        goToJointConfNoCheck(home_conf);
+        // The first joint states restart the monitor (once) from the actual error
+        if (rs.has_joints && !monitored)
+        {
+            conv.reset(t_tick.toSec(), error, error / HOME_JOINT_SPEED);
+            monitored = true;
+        }
 
+        ConvergenceMonitor::Status status = ConvergenceMonitor::CONVERGING;
+        if (rs.has_joints)
+        {
+            status = conv.update(t_tick.toSec(), error);
+        }
+        else if (conv.isTimedOut(t_tick.toSec()))
+        {
+            status = ConvergenceMonitor::TIMEOUT;
+        }
+
+        if (status != ConvergenceMonitor::CONVERGING)
+        {
+            reportMotion("homePoseStrict", conv, status, error);
+            return false;
+        }
+
+        audit.tick();
         r.sleep();
     }
 
+    reportMotion("homePoseStrict", conv, ConvergenceMonitor::REACHED, error);
+    joint_history.markSafe();
     return true;
 }
 
+double ArmCtrl::homeError(const RobotState &rs)
+{
+    double e = 0.0;
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     e = max(e, fabs(home_conf[j] - rs.q[j]));
+    return e;
+}
+
+ConvergenceMonitor ArmCtrl::makeConvergenceMonitor(const ArmParams &p, bool joint_space)
+{
+    double min_progress = joint_space ? JOINT_PROGRESS_SCALE * p.min_progress : p.min_progress;
+
+    return ConvergenceMonitor(p.stall_time, min_progress,
+                              MOTION_TIMEOUT_FACTOR, p.timeout_margin);
+}
+
+void ArmCtrl::reportMotion(const char *motion, ConvergenceMonitor &m,
+                           ConvergenceMonitor::Status s, double error)
+{
+    double t_elap = m.getElapsed(ros::Time::now().toSec());
+
+    ++n_motion_outcomes[s];
+    if (s == ConvergenceMonitor::REACHED)   settle_time.add(t_elap);
+
+    // Once per motion, and logging allocates inside rosconsole
+    alloc_audit::Pause ap;
+
+    if (s == ConvergenceMonitor::REACHED)
+    {
+        ROS_INFO("[%s] %s reached its goal in %.2f s, final error %.4f",
+                  getLimb().c_str(), motion, t_elap, error);
+    }
+    else
+    {
+        ROS_WARN("[%s] %s %s after %.2f s, final error %.4f (from %.4f), slope %.4f/s",
+                  getLimb().c_str(), motion, ConvergenceMonitor::statusToString(s),
+                  t_elap, error, m.getStartDistance(), m.getSlope());
+    }
+
+    ROS_INFO("[%s] Settle time: %s. Reached %lu, stalled %lu, oscillating %lu, timed out %lu",
+             getLimb().c_str(), settle_time.toString().c_str(),
+             n_motion_outcomes[ConvergenceMonitor::REACHED],
+             n_motion_outcomes[ConvergenceMonitor::STALLED],
+             n_motion_outcomes[ConvergenceMonitor::OSCILLATING],
+             n_motion_outcomes[ConvergenceMonitor::TIMEOUT]);
+}
+
 void ArmCtrl::setHomeConf(double s0, double s1, double e0, double e1,
                                      double w0, double w1, double w2)
 {
@@ -573,12 +1730,126 @@ bool ArmCtrl::goHome()
 
 void ArmCtrl::recoverFromError()
 {
-    if (internal_recovery == true)
+    ArmParams p = getParams();
+
+    if (p.internal_recovery == true)
     {
+        ros::WallTime t_start = ros::WallTime::now();
+
+        if (p.recovery_mode == RECOVERY_RETREAT)
+        {
+            if (retreatAlongPath(p.retreat_distance))
+            {
+                recovery_time_retreat.add((ros::WallTime::now() - t_start).toSec());
+                ROS_INFO("[%s] Recovered by retreating. Recovery time (retreat): %s",
+                   getLimb().c_str(), recovery_time_retreat.toString().c_str());
+                return;
+            }
+
+            ROS_WARN("[%s] Unable to retreat along the path, going home", getLimb().c_str());
+        }
+
         goHome();
+        recovery_time_home.add((ros::WallTime::now() - t_start).toSec());
+        ROS_INFO("[%s] Recovered by going home. Recovery time (home): %s",
+                      getLimb().c_str(), recovery_time_home.toString().c_str());
     }
 }
 
+/**
+ * Max absolute difference between two joint configurations
+ */
+static double maxJointError(const double q0[BAXTER_NUM_JOINTS],
+                            const double q1[BAXTER_NUM_JOINTS])
+{
+    double d = 0.0;
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     d = max(d, fabs(q1[j] - q0[j]));
+    return d;
+}
+
+bool ArmCtrl::retreatAlongPath(double max_dist)
+{
+    size_t n = joint_history.getRetreatPath(retreat_path);
+    if (n == 1 && retreat_path[0].safe)
+    {
+        ROS_INFO("[%s] Still where the last motion completed: nothing to retreat",
+                                                            getLimb().c_str());
+        return true;
+    }
+    if (n < 2)      return false;
+
+    // Cut the path once it has gone back max_dist in Cartesian space
+    baxter_kinematics::Limb limb = getLimb() == "left" ? baxter_kinematics::LEFT
+                                                       : baxter_kinematics::RIGHT;
+    baxter_kinematics::Joints q;
+    Eigen::Vector3d pos, pos_prev;
+    Eigen::Matrix3d rot;
+
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     q(j) = retreat_path[0].q[j];
+    baxter_kinematics::fk(limb, q, pos_prev, rot);
+
+    size_t m   = 1;
+    double len = 0.0;
+    retreat_len[0] = 0.0;
+    for (; m < n; ++m)
+    {
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     q(j) = retreat_path[m].q[j];
+        baxter_kinematics::fk(limb, q, pos, rot);
+
+        retreat_len[m] = (pos - pos_prev).norm();
+        len           += retreat_len[m];
+        pos_prev       = pos;
+        if (len >= max_dist)    break;
+    }
+    m = min(m, n - 1);
+
+    ROS_INFO("[%s] Retreating along %zu samples of the recent path (%g m)",
+                                              getLimb().c_str(), m, len);
+
+    double rate_hz = getParams().loop_rate;
+    ros::Rate r(rate_hz);
+
+    size_t     i = 1;
+    ros::Time t_wp = ros::Time::now();
+    while(RobotInterface::ok())
+    {
+        ArmParams prm = getParams();
+        adaptRate(r, rate_hz, prm);
+
+        RobotState rs = robot_state.load();
+        if (!rs.has_joints)     return false;
+
+        // Stream the path: move on as soon as the arm is close to a waypoint
+        while (i < m && maxJointError(rs.q, retreat_path[i].q) < RETREAT_WAYPOINT_TOL)
+        {
+            ++i;
+            t_wp = ros::Time::now();
+        }
+
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     replay_q[j] = retreat_path[i].q[j];
+
+        if (i == m && maxJointError(rs.q, retreat_path[i].q) < JOINT_TOLERANCE)   break;
+
+        {
+            alloc_audit::Pause p;
+            goToJointConfNoCheck(replay_q);
+        }
+
+        // The arm is stuck, e.g. blocked by whatever caused the error
+        double timeout = MOTION_TIMEOUT_FACTOR * retreat_len[i] / prm.arm_speed + prm.stall_time;
+        if ((ros::Time::now() - t_wp).toSec() > timeout)
+        {
+            ROS_WARN("[%s] Retreat stuck at waypoint %zu of %zu", getLimb().c_str(), i, m);
+            return false;
+        }
+
+        r.sleep();
+    }
+
+    joint_history.markSafe();
+    return RobotInterface::ok();
+}
+
 void ArmCtrl::setState(int _state)
 {
     if (_state == KILLED && getState() != WORKING)
@@ -620,17 +1891,61 @@ void ArmCtrl::setMode(string _mode)
     publishState();
 }
 
+void ArmCtrl::publishTelemetry(const RobotState &rs,
+                               const Point &cmd_pos, const Quaternion &cmd_ori,
+                               const Point &des_pos, const ros::Time  &t_tick)
+{
+    if (!telemetry.isOpen())    return;
+
+    // Single writer: a sample that would race with another loop is dropped
+    std::unique_lock<std::mutex> lck(mtx_telemetry, std::try_to_lock);
+    if (!lck.owns_lock())   return;
+
+    // The loop timing is meaningless across ticks of different loops
+    if (telemetry_thread != std::this_thread::get_id())
+    {
+        telemetry_thread = std::this_thread::get_id();
+        last_tick        = ros::Time();
+    }
+
+    TelemetrySample s;
+    s.stamp       = t_tick.toSec();
+
+    s.meas_pos[0] = rs.pos[0];  s.meas_pos[1] = rs.pos[1];  s.meas_pos[2] = rs.pos[2];
+    s.meas_ori[0] = rs.ori[0];  s.meas_ori[1] = rs.ori[1];
+    s.meas_ori[2] = rs.ori[2];  s.meas_ori[3] = rs.ori[3];
+    s.cmd_pos[0]  = cmd_pos.x;  s.cmd_pos[1]  = cmd_pos.y;  s.cmd_pos[2]  = cmd_pos.z;
+    s.cmd_ori[0]  = cmd_ori.x;  s.cmd_ori[1]  = cmd_ori.y;
+    s.cmd_ori[2]  = cmd_ori.z;  s.cmd_ori[3]  = cmd_ori.w;
+    s.des_pos[0]  = des_pos.x;  s.des_pos[1]  = des_pos.y;  s.des_pos[2]  = des_pos.z;
+
+    s.state       = int(getState());
+    s.loop_dt     = last_tick.isZero() ? 0.0 : (t_tick - last_tick).toSec();
+    s.loop_work   = (ros::Time::now() - t_tick).toSec();
+
+    struct timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    s.cpu_time    = cpu.tv_sec + 1e-9 * cpu.tv_nsec;
+    last_tick     = t_tick;
+
+    telemetry.write(s);
+}
+
 void ArmCtrl::publishState()
 {
-    baxter_control::ArmState msg;
+    std::lock_guard<std::mutex> lck(mtx_state_msg);
 
-    msg.state  = string(getState());
-    msg.action = getAction();
+    // Reuse the message buffers: assign() keeps the capacity
+    // already reserved in the constructor
+    state_msg.state.assign(string(getState()));
+    state_msg.action.assign(action);
 
-    state_pub.publish(msg);
+    state_pub.publish(state_msg);
 }
 
 ArmCtrl::~ArmCtrl()
 {
     killInternalThread();
+    delete reconf_server;
+    delete resolved_rate;
 }
@@ -0,0 +1,122 @@
+#include "baxter_interface/cartesian_path.h"
+#include "baxter_interface/motion_profile.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+CartesianPath::CartesianPath(size_t capacity) : n(0), dt(0.01)
+{
+    capacity = max(capacity, size_t(1));
+
+    u .resize(capacity, 0.0);
+    x .resize(capacity, 0.0);
+    y .resize(capacity, 0.0);
+    z .resize(capacity, 0.0);
+    qx.resize(capacity, 0.0);
+    qy.resize(capacity, 0.0);
+    qz.resize(capacity, 0.0);
+    qw.resize(capacity, 0.0);
+
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     q[j].resize(capacity, 0.0);
+}
+
+bool CartesianPath::sample(const double p0[3], const double o0[4], const double dp[3],
+                           const double drot[3], double speed, double accel)
+{
+    double d_lin = sqrt(dp[0]*dp[0] + dp[1]*dp[1] + dp[2]*dp[2]);
+    double theta = sqrt(drot[0]*drot[0] + drot[1]*drot[1] + drot[2]*drot[2]);
+
+    // The slower of translation and rotation sets the pace of both
+    double len = max(d_lin, CARTESIAN_PATH_ROT_RADIUS * theta);
+    double dur = len > 0.0 ? motion_profile::duration(len, speed, accel) : 0.0;
+
+    dt = CARTESIAN_PATH_DT;
+    size_t m = size_t(ceil(dur / dt)) + 1;
+    if (m > u.size())   return false;
+    n = m;
+
+    // The profile is piecewise, so it is the only per-sample branching
+    for (size_t i = 0; i < n; ++i)
+    {
+        u[i] = len > 0.0 ? motion_profile::position(i * dt, len, speed, accel) / len : 1.0;
+    }
+    u[n-1] = 1.0;
+
+    double *pu  = &u[0];
+    double *px  = &x[0],  *py  = &y[0],  *pz  = &z[0];
+    double *pqx = &qx[0], *pqy = &qy[0], *pqz = &qz[0], *pqw = &qw[0];
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        px[i] = p0[0] + pu[i] * dp[0];
+        py[i] = p0[1] + pu[i] * dp[1];
+        pz[i] = p0[2] + pu[i] * dp[2];
+    }
+
+    // Orientation: r(u) * o0, with r(u) the rotation of u*theta about the axis
+    double ax = 0.0, ay = 0.0, az = 0.0;
+    if (theta > 0.0)
+    {
+        ax = drot[0] / theta;
+        ay = drot[1] / theta;
+        az = drot[2] / theta;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        double h  = 0.5 * theta * pu[i];
+        double rw = cos(h);
+        double sh = sin(h);
+        double rx = ax * sh, ry = ay * sh, rz = az * sh;
+
+        pqx[i] = rw * o0[0] + rx * o0[3] + ry * o0[2] - rz * o0[1];
+        pqy[i] = rw * o0[1] - rx * o0[2] + ry * o0[3] + rz * o0[0];
+        pqz[i] = rw * o0[2] + rx * o0[1] - ry * o0[0] + rz * o0[3];
+        pqw[i] = rw * o0[3] - rx * o0[0] - ry * o0[1] - rz * o0[2];
+    }
+
+    return true;
+}
+
+void CartesianPath::interpolateJoints(size_t i0, size_t i1)
+{
+    if (i1 <= i0 + 1)   return;
+
+    double inv = 1.0 / double(i1 - i0);
+
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+    {
+        double *pq = &q[j][0];
+        double  q0 = pq[i0];
+        double  dq = pq[i1] - q0;
+
+        for (size_t i = i0 + 1; i < i1; ++i)
+        {
+            pq[i] = q0 + dq * double(i - i0) * inv;
+        }
+    }
+}
+
+double CartesianPath::jointsAt(double t, double qt[BAXTER_NUM_JOINTS], double pt[3])
+{
+    double s = n > 1 ? t / dt : 0.0;
+    size_t i = s > 0.0 ? min(size_t(s), n - 1) : 0;
+    size_t k = min(i + 1, n - 1);
+    double w = min(max(s - double(i), 0.0), 1.0);
+
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+    {
+        qt[j] = q[j][i] + w * (q[j][k] - q[j][i]);
+    }
+
+    if (pt != NULL)
+    {
+        pt[0] = x[i] + w * (x[k] - x[i]);
+        pt[1] = y[i] + w * (y[k] - y[i]);
+        pt[2] = z[i] + w * (z[k] - z[i]);
+    }
+
+    return u[i] + w * (u[k] - u[i]);
+}
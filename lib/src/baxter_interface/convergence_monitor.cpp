@@ -0,0 +1,104 @@
+#include "baxter_interface/convergence_monitor.h"
+
+// Slope reversals, without any improvement in between, that make an oscillation
+#define OSCILLATION_REVERSALS   4
+
+// Once the distance reverses, the stall window is stretched to this many
+// stall_time, and two reversals within it are already an oscillation
+#define OSCILLATION_WINDOW      4.0
+#define OSCILLATION_MIN_REVERSALS 2
+
+ConvergenceMonitor::ConvergenceMonitor(double _stall_time, double _min_progress,
+                                       double _timeout_factor, double _timeout_margin) :
+                                       stall_time(_stall_time), min_progress(_min_progress),
+                                       timeout_factor(_timeout_factor),
+                                       timeout_margin(_timeout_margin)
+{
+    reset(0.0, 0.0, 0.0);
+}
+
+void ConvergenceMonitor::reset(double t, double d, double expected)
+{
+    t_start     = t;
+    t_timeout   = t + timeout_factor * expected + timeout_margin;
+    d_start     = d;
+    d_best      = d;
+    t_best      = t;
+    d_last      = d;
+    d_extremum  = d;
+    direction   = 0;
+    n_reversals = 0;
+    slope       = 0.0;
+    t_last      = t;
+}
+
+ConvergenceMonitor::Status ConvergenceMonitor::update(double t, double d, double d_ref)
+{
+    // Low-pass filtered slope, with a time constant of a tenth of stall_time
+    double dt = t - t_last;
+    if (dt > 0.0)
+    {
+        double a = dt / (dt + 0.1 * stall_time);
+        slope   += a * ((d - d_last) / dt - slope);
+    }
+    d_last = d;
+    t_last = t;
+
+    if (d < d_best - min_progress)
+    {
+        d_best      = d;
+        t_best      = t;
+        d_extremum  = d;
+        direction   = -1;
+        n_reversals = 0;
+    }
+    else
+    {
+        // Direction changes, with some hysteresis against the noise
+        double hyst = 0.5 * min_progress;
+        if      (direction >= 0 && d < d_extremum - hyst)
+        {
+            if (direction > 0)  ++n_reversals;
+            direction  = -1;
+            d_extremum = d;
+        }
+        else if (direction <= 0 && d > d_extremum + hyst)
+        {
+            if (direction < 0)  ++n_reversals;
+            direction  = +1;
+            d_extremum = d;
+        }
+        else if ((direction < 0 && d < d_extremum) || (direction > 0 && d > d_extremum))
+        {
+            d_extremum = d;
+        }
+    }
+
+    // Keeping up with the profile is progress, however slow the profile is
+    if (d_ref >= 0.0 && d <= d_ref + min_progress)  t_best = t;
+
+    if (t > t_timeout)                              return TIMEOUT;
+    if (n_reversals >= OSCILLATION_REVERSALS)       return OSCILLATING;
+
+    double window = n_reversals > 0 ? OSCILLATION_WINDOW * stall_time : stall_time;
+    if (t - t_best > window)
+    {
+        return n_reversals >= OSCILLATION_MIN_REVERSALS ? OSCILLATING : STALLED;
+    }
+
+    return CONVERGING;
+}
+
+const char* ConvergenceMonitor::statusToString(Status s)
+{
+    switch (s)
+    {
+        case CONVERGING:    return "converging";
+        case REACHED:       return "reached";
+        case STALLED:       return "stalled";
+        case OSCILLATING:   return "oscillating";
+        case TIMEOUT:       return "timed out";
+    }
+
+    return "unknown";
+}
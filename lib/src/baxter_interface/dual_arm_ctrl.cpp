@@ -0,0 +1,208 @@
+#include "baxter_interface/dual_arm_ctrl.h"
+#include "baxter_interface/motion_profile.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+using namespace geometry_msgs;
+
+// Max time for the arms to acknowledge the handover [s]
+#define HANDOVER_TIMEOUT    2.0
+
+DualArmCtrl::DualArmCtrl(string _name, ArmCtrl *_left, ArmCtrl *_right) :
+                         name(_name), left(_left), right(_right),
+                         _n(_name), new_target(false)
+{
+    std::string topic = "/"+name+"/dual_target";
+    target_sub = _n.subscribe(topic, 1, &DualArmCtrl::targetCb, this);
+    ROS_INFO("[dual] Created target subscriber with name  : %s", topic.c_str());
+
+    startInternalThread();
+}
+
+void DualArmCtrl::targetCb(const baxter_control::DualArmPos::ConstPtr& msg)
+{
+    std::lock_guard<std::mutex> lck(mtx_target);
+
+    left_goal.x  = msg->left.xpos;
+    left_goal.y  = msg->left.ypos;
+    left_goal.z  = msg->left.zpos;
+    right_goal.x = msg->right.xpos;
+    right_goal.y = msg->right.ypos;
+    right_goal.z = msg->right.zpos;
+    new_target   = true;
+}
+
+double DualArmCtrl::initSegment(ArmCtrl *arm, const Point &goal, Segment &seg)
+{
+    RobotState rs = arm->getRobotState();
+    seg.start = ArmCtrl::statePos(rs);
+    seg.ori   = ArmCtrl::stateOri(rs);
+    seg.goal  = goal;
+
+    double dx = goal.x - seg.start.x;
+    double dy = goal.y - seg.start.y;
+    double dz = goal.z - seg.start.z;
+
+    return sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+double DualArmCtrl::distance(const RobotState &rs, const Point &p)
+{
+    double dx = p.x - rs.pos[0];
+    double dy = p.y - rs.pos[1];
+    double dz = p.z - rs.pos[2];
+
+    return sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+Point DualArmCtrl::interpolate(const Segment &seg, double s)
+{
+    Point p;
+    p.x = seg.start.x + s * (seg.goal.x - seg.start.x);
+    p.y = seg.start.y + s * (seg.goal.y - seg.start.y);
+    p.z = seg.start.z + s * (seg.goal.z - seg.start.z);
+    return p;
+}
+
+void DualArmCtrl::InternalThreadEntry()
+{
+    Segment seg_l, seg_r;
+    Point  goal_l, goal_r;
+
+    bool   moving = false;
+    double length = 0.0, speed = 0.0, accel = 0.0, duration = 0.0;
+    ros::Time t_start;
+    ConvergenceMonitor conv;
+
+    // The stricter (i.e. faster) rate of the two arms
+    double rate_hz = loopRate();
+    ros::Rate r(rate_hz);
+    while (ros::ok())
+    {
+        double hz = loopRate();
+        if (hz != rate_hz)
+        {
+            rate_hz = hz;
+            r       = ros::Rate(rate_hz);
+        }
+
+        bool update = false;
+        {
+            std::lock_guard<std::mutex> lck(mtx_target);
+            if (new_target)
+            {
+                goal_l     = left_goal;
+                goal_r     = right_goal;
+                new_target = false;
+                update     = true;
+            }
+        }
+
+        if (update)
+        {
+            // Take both arms over before sampling their start poses, and wait
+            // for their own loops to stop commanding before sending anything
+            left ->setExternalControl(true);
+            right->setExternalControl(true);
+
+            if (!left ->waitExternalControl(HANDOVER_TIMEOUT) ||
+                !right->waitExternalControl(HANDOVER_TIMEOUT))
+            {
+                ROS_ERROR("[dual] The arms did not hand over control, dropping the paired target");
+                left ->setExternalControl(false);
+                right->setExternalControl(false);
+                moving = false;
+                r.sleep();
+                continue;
+            }
+
+            double d_l = initSegment(left,  goal_l, seg_l);
+            double d_r = initSegment(right, goal_r, seg_r);
+
+            // The most conservative limits of the two arms
+            ArmParams p_l = left ->getParams();
+            ArmParams p_r = right->getParams();
+            speed = min(p_l.arm_speed, p_r.arm_speed);
+            accel = min(p_l.arm_accel, p_r.arm_accel);
+            if (accel <= 0.0)   accel = max(p_l.arm_accel, p_r.arm_accel);  // 0 is no limit
+
+            // Both paths are time-scaled to the slower (i.e. longer) one
+            length   = max(d_l, d_r);
+            duration = motion_profile::duration(length, speed, accel);
+            t_start  = ros::Time::now();
+            moving   = true;
+
+            // Bounded as the single-arm motions, with the more lenient limits
+            ArmParams p_c      = p_l;
+            p_c.stall_time     = max(p_l.stall_time,     p_r.stall_time);
+            p_c.min_progress   = min(p_l.min_progress,   p_r.min_progress);
+            p_c.timeout_margin = max(p_l.timeout_margin, p_r.timeout_margin);
+            conv = ArmCtrl::makeConvergenceMonitor(p_c);
+            conv.reset(t_start.toSec(), length, duration);
+
+            ROS_INFO("[dual] New paired target: left %g m, right %g m, duration %g s",
+                                                                d_l, d_r, duration);
+        }
+
+        if (moving)
+        {
+            ros::Time t_tick = ros::Time::now();
+            double t_elap = (ros::Time::now() - t_start).toSec();
+            double s      = length > 0.0 ? motion_profile::position(t_elap, length,
+                                                        speed, accel) / length : 1.0;
+
+            // Commands for both arms are issued in the same tick
+            left ->sendPoseCommand(interpolate(seg_l, s), seg_l.ori);
+            right->sendPoseCommand(interpolate(seg_r, s), seg_r.ori);
+
+            RobotState rs_l = left ->getRobotState();
+            RobotState rs_r = right->getRobotState();
+
+            if (s >= 1.0 && left ->isPoseReached(rs_l, seg_l.goal, POS_MODE_LOOSE)
+                         && right->isPoseReached(rs_r, seg_r.goal, POS_MODE_LOOSE))
+            {
+                ROS_INFO("[dual] Paired target reached in %g s",
+                                (ros::Time::now() - t_start).toSec());
+
+                left ->setExternalControl(false);
+                right->setExternalControl(false);
+                moving = false;
+            }
+            else
+            {
+                // The arm lagging the most sets the progress of the pair
+                double error = max(distance(rs_l, seg_l.goal), distance(rs_r, seg_r.goal));
+                ConvergenceMonitor::Status status = conv.update(t_tick.toSec(), error,
+                                                                (1.0 - s) * length);
+                if (status != ConvergenceMonitor::CONVERGING)
+                {
+                    ROS_WARN("[dual] Paired target %s after %g s, error %g m (from %g m)",
+                             ConvergenceMonitor::statusToString(status),
+                             conv.getElapsed(t_tick.toSec()), error, length);
+
+                    // Give both arms back, holding their current pose
+                    left ->setExternalControl(false);
+                    right->setExternalControl(false);
+                    moving = false;
+                }
+            }
+        }
+
+        r.sleep();
+    }
+
+    closeInternalThread();
+    return;
+}
+
+double DualArmCtrl::loopRate()
+{
+    return max(left->getParams().loop_rate, right->getParams().loop_rate);
+}
+
+DualArmCtrl::~DualArmCtrl()
+{
+    killInternalThread();
+}
@@ -0,0 +1,74 @@
+#include "baxter_interface/joint_history.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+JointHistory::JointHistory(size_t _capacity, double _min_step) :
+                           buf(max(_capacity, size_t(1))), head(0), n(0),
+                           min_step(_min_step)
+{
+
+}
+
+void JointHistory::push(const double q[BAXTER_NUM_JOINTS])
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    if (n > 0)
+    {
+        const JointSample &last = buf[(head + buf.size() - 1) % buf.size()];
+
+        double d = 0.0;
+        for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)
+        {
+            d = max(d, fabs(q[j] - last.q[j]));
+        }
+
+        if (d < min_step)   return;
+    }
+
+    JointSample &s = buf[head];
+    for (int j = 0; j < BAXTER_NUM_JOINTS; ++j)     s.q[j] = q[j];
+    s.safe = false;
+
+    head = (head + 1) % buf.size();
+    if (n < buf.size())     ++n;
+}
+
+void JointHistory::markSafe()
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    if (n > 0)  buf[(head + buf.size() - 1) % buf.size()].safe = true;
+}
+
+size_t JointHistory::getRetreatPath(vector<JointSample> &path)
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    size_t m = 0;
+    while (m < n && m < path.size())
+    {
+        path[m] = buf[(head + buf.size() - 1 - m) % buf.size()];
+
+        // If the most recent sample is safe, the arm has not moved since the
+        // last completed motion, and there is nothing to retreat
+        if (path[m].safe)
+        {
+            return m + 1;
+        }
+        ++m;
+    }
+
+    return m;
+}
+
+void JointHistory::clear()
+{
+    std::lock_guard<std::mutex> lck(mtx);
+
+    head = 0;
+    n    = 0;
+}
@@ -0,0 +1,189 @@
+#include "baxter_interface/marker_pipeline.h"
+
+#include <cv_bridge/cv_bridge.h>
+#include <aruco_ros/aruco_ros_utils.h>
+
+using namespace std;
+
+MarkerPipeline::MarkerPipeline(string _name, const vector<ArmCtrl*> &_arms) :
+                               name(_name), _n(_name), it(_n), arms(_arms),
+                               has_cam(false), n_frames(0), n_dropped(0),
+                               stop(false), latency(1000), n_markers(0)
+{
+    string image_topic, info_topic;
+    _n.param<string>("aruco_image_topic", image_topic, "/cameras/left_hand_camera/image");
+    _n.param<string>("aruco_info_topic",   info_topic, "/cameras/left_hand_camera/camera_info");
+    _n.param<string>("aruco_base_frame",   base_frame, "base");
+    _n.param<double>("aruco_marker_size", marker_size, 0.04);
+    _n.param<double>("aruco_approach_height", approach_height, 0.10);
+    _n.param<int>   ("aruco_workers",       n_workers, 2);
+    _n.param<int>   ("aruco_queue_size",   queue_size, 1);
+
+    n_workers  = max(n_workers,  1);
+    queue_size = max(queue_size, 1);
+
+    for (int i = 0; i < n_workers; ++i)
+    {
+        workers.push_back(std::thread(&MarkerPipeline::workerLoop, this));
+    }
+
+    info_sub  = _n.subscribe(info_topic, 1, &MarkerPipeline::cameraInfoCb, this);
+    image_sub = it.subscribe(image_topic, 1, &MarkerPipeline::imageCb, this);
+
+    ROS_INFO("[aruco] Created image subscriber with name : %s (%i workers)",
+                                          image_topic.c_str(), n_workers);
+}
+
+void MarkerPipeline::cameraInfoCb(const sensor_msgs::CameraInfoConstPtr& msg)
+{
+    std::lock_guard<std::mutex> lck(mtx_cam);
+
+    cam_params = aruco_ros::rosCameraInfo2ArucoCamParams(*msg, false);
+    has_cam    = true;
+}
+
+void MarkerPipeline::imageCb(const sensor_msgs::ImageConstPtr& msg)
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx_queue);
+
+        // Under load, the oldest frame gives way to the newest one
+        if (int(queue.size()) >= queue_size)
+        {
+            queue.pop_front();
+            ++n_dropped;
+        }
+
+        Frame f;
+        f.img = msg;
+        f.seq = ++n_frames;
+        queue.push_back(f);
+    }
+
+    cv_queue.notify_one();
+}
+
+void MarkerPipeline::workerLoop()
+{
+    // The detector keeps internal buffers, so each worker has its own
+    aruco::MarkerDetector detector;
+
+    while (true)
+    {
+        Frame f;
+        {
+            std::unique_lock<std::mutex> lck(mtx_queue);
+            cv_queue.wait(lck, [this]{ return stop || !queue.empty(); });
+
+            if (stop)   return;
+
+            f = queue.front();
+            queue.pop_front();
+        }
+
+        processFrame(detector, f);
+    }
+}
+
+void MarkerPipeline::processFrame(aruco::MarkerDetector &detector, const Frame &f)
+{
+    aruco::CameraParameters cp;
+    {
+        std::lock_guard<std::mutex> lck(mtx_cam);
+        if (!has_cam)   return;
+        cp = cam_params;
+    }
+
+    cv_bridge::CvImageConstPtr cv_img;
+    try
+    {
+        cv_img = cv_bridge::toCvShare(f.img, "bgr8");
+    }
+    catch (cv_bridge::Exception& e)
+    {
+        ROS_ERROR_THROTTLE(1.0, "[aruco] cv_bridge exception: %s", e.what());
+        return;
+    }
+
+    vector<aruco::Marker> markers;
+    detector.detect(cv_img->image, markers, cp, marker_size, false);
+
+    if (markers.empty())    return;
+
+    const std_msgs::Header &h = f.img->header;
+
+    tf::StampedTransform base_to_cam;
+    try
+    {
+        tf_listener.waitForTransform(base_frame, h.frame_id, h.stamp, ros::Duration(0.05));
+        tf_listener.lookupTransform (base_frame, h.frame_id, h.stamp, base_to_cam);
+    }
+    catch (tf::TransformException& e)
+    {
+        ROS_WARN_THROTTLE(1.0, "[aruco] %s", e.what());
+        return;
+    }
+
+    for (size_t i = 0; i < markers.size(); ++i)
+    {
+        if (!markers[i].isValid())  continue;
+
+        tf::Transform marker = base_to_cam * aruco_ros::arucoMarker2Tf(markers[i]);
+
+        geometry_msgs::PoseStamped pose;
+        pose.header.stamp    = h.stamp;
+        pose.header.frame_id = base_frame;
+        tf::poseTFToMsg(marker, pose.pose);
+
+        for (size_t j = 0; j < arms.size(); ++j)
+        {
+            arms[j]->setObjectPose(markers[i].id, pose);
+
+            if (markers[i].id != arms[j]->getMarkerID())    continue;
+
+            baxter_control::ArmPosStamped target;
+            target.header           = pose.header;
+            target.sequence         = f.seq;
+            target.pose.position    = pose.pose.position;
+            target.pose.position.z += approach_height;
+            target.pose.orientation = ArmCtrl::stateOri(arms[j]->getRobotState());
+            target.has_velocity     = false;
+
+            arms[j]->setDesiredPoseStamped(target, TARGET_SRC_MARKERS);
+        }
+    }
+
+    std::lock_guard<std::mutex> lck(mtx_stats);
+
+    latency.add((ros::Time::now() - h.stamp).toSec());
+    n_markers += markers.size();
+
+    if (latency.getTotal() % 100 == 0)
+    {
+        unsigned long n_drop;
+        {
+            std::lock_guard<std::mutex> lck_q(mtx_queue);
+            n_drop = n_dropped;
+        }
+
+        ROS_INFO("[aruco] Image to target latency: %s. %lu markers, %lu frames dropped",
+                            latency.toString().c_str(), n_markers, n_drop);
+    }
+}
+
+MarkerPipeline::~MarkerPipeline()
+{
+    image_sub.shutdown();
+    info_sub.shutdown();
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_queue);
+        stop = true;
+    }
+    cv_queue.notify_all();
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+}
@@ -0,0 +1,198 @@
+#include "baxter_interface/motion_library.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+MotionLibrary::MotionLibrary() : path(""), fd(-1), lib(NULL), n_hits(0),
+                                 n_misses(0), n_invalid(0), time_saved(0.0)
+{
+
+}
+
+bool MotionLibrary::open(const string &_path)
+{
+    close();
+
+    fd = ::open(_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)                                             return false;
+
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    bool fresh = fstat(fd, &st) != 0 || st.st_size != off_t(sizeof(MotionLibraryFile));
+
+    if (fresh && ftruncate(fd, sizeof(MotionLibraryFile)) != 0)
+    {
+        flock(fd, LOCK_UN);
+        close();
+        return false;
+    }
+
+    void *addr = mmap(NULL, sizeof(MotionLibraryFile), PROT_READ | PROT_WRITE,
+                                                       MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        flock(fd, LOCK_UN);
+        close();
+        return false;
+    }
+
+    lib  = static_cast<MotionLibraryFile*>(addr);
+    path = _path;
+
+    // A new file, or one with a different layout, is wiped
+    if (fresh || lib->magic     != MOTION_LIB_MAGIC   ||
+                 lib->version   != MOTION_LIB_VERSION ||
+                 lib->n_entries != MOTION_LIB_ENTRIES ||
+                 lib->n_samples != MOTION_LIB_SAMPLES)
+    {
+        memset(static_cast<void*>(lib), 0, sizeof(MotionLibraryFile));
+        lib->version   = MOTION_LIB_VERSION;
+        lib->n_entries = MOTION_LIB_ENTRIES;
+        lib->n_samples = MOTION_LIB_SAMPLES;
+        lib->magic     = MOTION_LIB_MAGIC;
+    }
+
+    flock(fd, LOCK_UN);
+    return true;
+}
+
+void MotionLibrary::close()
+{
+    if (lib != NULL)
+    {
+        msync(lib, sizeof(MotionLibraryFile), MS_ASYNC);
+        munmap(lib, sizeof(MotionLibraryFile));
+        lib = NULL;
+    }
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+MotionKey MotionLibrary::makeKey(const string &limb, const string &mode,
+                                 const double q0[BAXTER_NUM_JOINTS], const double goal[3])
+{
+    MotionKey k;
+    memset(&k, 0, sizeof(k));   // the key is compared with memcmp
+
+    k.limb = limb == "left"   ? 0 : 1;
+    k.mode = mode == "strict" ? 1 : 0;
+
+    for (int i = 0; i < BAXTER_NUM_JOINTS; ++i)
+    {
+        k.q0[i] = int32_t(lround(q0[i] / MOTION_LIB_Q_STEP));
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        k.goal[i] = int32_t(lround(goal[i] / MOTION_LIB_X_STEP));
+    }
+
+    return k;
+}
+
+uint32_t MotionLibrary::hash(const MotionKey &k)
+{
+    // FNV-1a
+    const unsigned char *b = reinterpret_cast<const unsigned char*>(&k);
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(MotionKey); ++i)
+    {
+        h = (h ^ b[i]) * 16777619u;
+    }
+    return h;
+}
+
+bool MotionLibrary::lookup(const MotionKey &k, MotionTrajectory &t)
+{
+    if (lib == NULL)    return false;
+
+    uint32_t h = hash(k);
+
+    for (int p = 0; p < MOTION_LIB_PROBES; ++p)
+    {
+        MotionEntry &e = lib->entries[(h + p) % MOTION_LIB_ENTRIES];
+
+        uint32_t seq0 = e.seq.load(memory_order_acquire);
+        if (seq0 & 1)                                       continue;
+        if (!e.used || memcmp(&e.key, &k, sizeof(k)) != 0)  continue;
+
+        memcpy(t.q, e.q, sizeof(t.q));
+        t.ik_time = e.ik_time;
+
+        atomic_thread_fence(memory_order_acquire);
+        if (e.seq.load(memory_order_relaxed) != seq0)       return false;
+
+        e.n_hits++;    // statistics only, races are harmless
+        return true;
+    }
+
+    return false;
+}
+
+bool MotionLibrary::store(const MotionKey &k, const MotionTrajectory &t)
+{
+    if (lib == NULL)    return false;
+
+    flock(fd, LOCK_EX);
+
+    // Same key, or a free slot, or the least used one among the probed slots
+    uint32_t   h = hash(k);
+    MotionEntry *slot = NULL;
+
+    for (int p = 0; p < MOTION_LIB_PROBES; ++p)
+    {
+        MotionEntry &e = lib->entries[(h + p) % MOTION_LIB_ENTRIES];
+
+        if (!e.used || memcmp(&e.key, &k, sizeof(k)) == 0)
+        {
+            slot = &e;
+            break;
+        }
+
+        if (slot == NULL || e.n_hits < slot->n_hits)    slot = &e;
+    }
+
+    // Clearing the low bit also recovers entries left odd by a crashed writer
+    uint32_t seq = slot->seq.load(memory_order_relaxed) & ~1u;
+    slot->seq.store(seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->used    = 1;
+    slot->key     = k;
+    slot->n_hits  = 0;
+    slot->ik_time = t.ik_time;
+    memcpy(slot->q, t.q, sizeof(slot->q));
+
+    slot->seq.store(seq + 2, memory_order_release);
+
+    flock(fd, LOCK_UN);
+    return true;
+}
+
+string MotionLibrary::statsToString()
+{
+    unsigned long n = n_hits + n_misses;
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "hits %lu misses %lu (%.1f%%), invalid %lu, saved %.2f s",
+             n_hits, n_misses, n > 0 ? 100.0 * n_hits / n : 0.0, n_invalid, time_saved);
+    return string(buf);
+}
+
+MotionLibrary::~MotionLibrary()
+{
+    close();
+}
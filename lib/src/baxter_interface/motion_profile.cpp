@@ -0,0 +1,55 @@
+#include "baxter_interface/motion_profile.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * Duration of the acceleration phase, and cruise speed actually reached
+ */
+static void rampUp(double dist, double speed, double accel,
+                   double &t_acc, double &v_max)
+{
+    t_acc = speed / accel;
+    v_max = speed;
+
+    // Triangular profile: the cruise speed is never reached
+    if (accel * t_acc * t_acc > dist)
+    {
+        t_acc = sqrt(dist / accel);
+        v_max = accel * t_acc;
+    }
+}
+
+double motion_profile::duration(double dist, double speed, double accel)
+{
+    if (dist <= 0.0 || speed <= 0.0)    return 0.0;
+    if (accel <= 0.0)                   return dist / speed;
+
+    double t_acc, v_max;
+    rampUp(dist, speed, accel, t_acc, v_max);
+
+    double d_acc = 0.5 * accel * t_acc * t_acc;
+    return 2.0 * t_acc + (dist - 2.0 * d_acc) / v_max;
+}
+
+double motion_profile::position(double t, double dist, double speed, double accel)
+{
+    if (t <= 0.0 || dist <= 0.0)        return 0.0;
+    if (speed <= 0.0)                   return 0.0;
+    if (accel <= 0.0)                   return min(speed * t, dist);
+
+    double t_acc, v_max;
+    rampUp(dist, speed, accel, t_acc, v_max);
+
+    double d_acc = 0.5 * accel * t_acc * t_acc;
+    double t_tot = duration(dist, speed, accel);
+
+    if (t >= t_tot)                     return dist;
+    if (t <  t_acc)                     return 0.5 * accel * t * t;
+    if (t <  t_tot - t_acc)             return d_acc + v_max * (t - t_acc);
+
+    double t_left = t_tot - t;
+    return dist - 0.5 * accel * t_left * t_left;
+}
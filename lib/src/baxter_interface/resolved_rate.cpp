@@ -0,0 +1,70 @@
+#include "baxter_interface/resolved_rate.h"
+
+#include <math.h>
+#include <algorithm>
+#include <Eigen/Dense>
+
+using namespace std;
+
+// Baxter joint limits (s0 s1 e0 e1 w0 w1 w2), from the Baxter hardware specs
+static const double Q_MIN[BAXTER_NUM_JOINTS]  = {-1.7016, -2.147, -3.0541, -0.05,
+                                                 -3.059,  -1.5707, -3.059};
+static const double Q_MAX[BAXTER_NUM_JOINTS]  = { 1.7016,  1.047,  3.0541,  2.618,
+                                                  3.059,   2.094,   3.059};
+static const double QD_MAX[BAXTER_NUM_JOINTS] = { 2.0,     2.0,    2.0,     2.0,
+                                                  4.0,     4.0,     4.0};
+
+ResolvedRate::ResolvedRate(const string &_limb, double _tool) :
+                           limb(_limb == "left" ? baxter_kinematics::LEFT
+                                                : baxter_kinematics::RIGHT), tool(_tool),
+                           manipulability(0.0), w_threshold(0.02),
+                           lambda_max(0.1), limit_margin(0.1)
+{
+
+}
+
+bool ResolvedRate::computeJointVelocities(const double q[BAXTER_NUM_JOINTS],
+                                          const double twist[6],
+                                          double qdot[BAXTER_NUM_JOINTS])
+{
+    baxter_kinematics::Joints     q_v;
+    baxter_kinematics::Jacobian     J;
+
+    for (int i = 0; i < BAXTER_NUM_JOINTS; ++i)     q_v(i) = q[i];
+
+    baxter_kinematics::jacobian(limb, q_v, J, NULL, tool);
+    Eigen::Matrix<double, 6, 6> JJt = J * J.transpose();
+
+    // Damping grows quadratically as the manipulability goes to zero
+    manipulability = sqrt(max(JJt.determinant(), 0.0));
+    double lambda2 = 0.0;
+    if (manipulability < w_threshold)
+    {
+        double k = 1.0 - manipulability / w_threshold;
+        lambda2  = lambda_max * lambda_max * k * k;
+    }
+    JJt += lambda2 * Eigen::Matrix<double, 6, 6>::Identity();
+
+    Eigen::Matrix<double, 6, 1> v;
+    for (int i = 0; i < 6; ++i)     v(i) = twist[i];
+
+    Eigen::Matrix<double, BAXTER_NUM_JOINTS, 1> qd = J.transpose() * JJt.ldlt().solve(v);
+
+    // Slow down the joints that are moving into their limits
+    for (int i = 0; i < BAXTER_NUM_JOINTS; ++i)
+    {
+        double d = qd(i) < 0.0 ? q[i] - Q_MIN[i] : Q_MAX[i] - q[i];
+        if (d < limit_margin)    qd(i) *= max(d, 0.0) / limit_margin;
+    }
+
+    // Uniform scaling preserves the direction of the motion
+    double scale = 1.0;
+    for (int i = 0; i < BAXTER_NUM_JOINTS; ++i)
+    {
+        if (fabs(qd(i)) > QD_MAX[i])    scale = min(scale, QD_MAX[i] / fabs(qd(i)));
+    }
+
+    for (int i = 0; i < BAXTER_NUM_JOINTS; ++i)     qdot[i] = scale * qd(i);
+
+    return true;
+}
@@ -0,0 +1,150 @@
+#include "baxter_interface/stress_runner.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "baxter_control/ArmPos.h"
+
+using namespace std;
+
+StressRunner::StressRunner(string _name, int n) : name(_name), _n(_name)
+{
+    _n.param<double>("stress_rate",   rate,           10.0);
+    _n.param<double>("stress_radius", radius,         0.05);
+    _n.param<double>("stress_report", report_period,   5.0);
+
+    for (int i = 0; i < n; ++i)
+    {
+        Instance *inst = new Instance();
+
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s_stress_%i", name.c_str(), i);
+        inst->name = buf;
+        inst->limb = i % 2 == 0 ? "right" : "left";
+
+        long rss = residentMemory();
+        inst->arm       = new ArmCtrl(inst->name, inst->limb, true);
+        inst->rss_delta = residentMemory() - rss;
+
+        // Instances are spread along the circle, so that they do not all
+        // move in lockstep
+        inst->center = ArmCtrl::statePos(inst->arm->getRobotState());
+        inst->phase0 = 2.0 * M_PI * i / n;
+
+        string topic = "/"+inst->name+"/service_"+inst->limb;
+        inst->target_pub = _n.advertise<baxter_control::ArmPos>(topic, 1);
+
+        inst->telemetry_open = inst->telemetry.open(telemetryShmName(inst->name, inst->limb));
+        if (!inst->telemetry_open)
+        {
+            ROS_WARN("[stress] No telemetry for %s, the loop jitter will not be reported",
+                                                                     inst->name.c_str());
+        }
+
+        inst->timer = _n.createTimer(ros::Duration(1.0 / rate),
+                                     boost::bind(&StressRunner::targetCb, this, _1, inst));
+
+        instances.push_back(inst);
+        ROS_INFO("[stress] Created instance %s (%s), %li kB", inst->name.c_str(),
+                                               inst->limb.c_str(), inst->rss_delta);
+    }
+
+    last_report      = ros::WallTime::now();
+    process_cpu_last = processCpuTime();
+
+    // Faster than the reports, so that the telemetry rings do not wrap around
+    report_timer = _n.createTimer(ros::Duration(0.5), &StressRunner::reportCb, this);
+
+    ROS_INFO("[stress] %i instances, targets at %g Hz", n, rate);
+}
+
+void StressRunner::targetCb(const ros::TimerEvent &e, Instance *inst)
+{
+    // One lap every 5 s
+    double phase = inst->phase0 + 2.0 * M_PI * 0.2 * e.current_real.toSec();
+
+    baxter_control::ArmPos msg;
+    msg.xpos = inst->center.x + radius * cos(phase);
+    msg.ypos = inst->center.y + radius * sin(phase);
+    msg.zpos = inst->center.z;
+
+    inst->target_pub.publish(msg);
+    ++inst->n_targets;
+}
+
+void StressRunner::reportCb(const ros::TimerEvent &e)
+{
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        Instance *inst = instances[i];
+        if (!inst->telemetry_open)  continue;
+
+        double period = 1.0 / inst->arm->getParams().loop_rate;
+
+        TelemetrySample s;
+        while (inst->telemetry.next(s))
+        {
+            if (s.loop_dt > 0.0)    inst->jitter.add(fabs(s.loop_dt - period));
+            inst->cpu_curr = s.cpu_time;
+        }
+    }
+
+    double elap = (ros::WallTime::now() - last_report).toSec();
+    if (elap < report_period)   return;
+
+    double process_cpu = processCpuTime();
+    ROS_INFO("[stress] %zu instances: process CPU %.1f%%, resident memory %li kB",
+              instances.size(), 100.0 * (process_cpu - process_cpu_last) / elap,
+              residentMemory());
+
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        Instance *inst = instances[i];
+
+        ROS_INFO("[stress] %s: jitter %s, CPU %.1f%%, memory %li kB, %lu targets, "
+                 "%lu telemetry samples lost", inst->name.c_str(),
+                 inst->jitter.toString().c_str(),
+                 100.0 * (inst->cpu_curr - inst->cpu_last) / elap,
+                 inst->rss_delta, inst->n_targets,
+                 (unsigned long)inst->telemetry.getDropped());
+
+        inst->cpu_last = inst->cpu_curr;
+    }
+
+    last_report      = ros::WallTime::now();
+    process_cpu_last = process_cpu;
+}
+
+long StressRunner::residentMemory()
+{
+    long pages = 0;
+
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)  return 0;
+
+    if (fscanf(f, "%*ld %ld", &pages) != 1)     pages = 0;
+    fclose(f);
+
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+double StressRunner::processCpuTime()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+StressRunner::~StressRunner()
+{
+    report_timer.stop();
+
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        instances[i]->timer.stop();
+        delete instances[i]->arm;
+        delete instances[i];
+    }
+}
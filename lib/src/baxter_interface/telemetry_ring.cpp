@@ -0,0 +1,209 @@
+#include "baxter_interface/telemetry_ring.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+string telemetryShmName(const string &name, const string &limb)
+{
+    return "/baxter_control_" + name + "_" + limb;
+}
+
+/**************************************************************************/
+/*                            TelemetryWriter                             */
+/**************************************************************************/
+
+TelemetryWriter::TelemetryWriter() : shm_name(""), ring(NULL)
+{
+
+}
+
+bool TelemetryWriter::open(const string &_shm_name)
+{
+    close();
+
+    int fd = shm_open(_shm_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)                                             return false;
+
+    if (ftruncate(fd, sizeof(TelemetryRing)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *addr = mmap(NULL, sizeof(TelemetryRing), PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)                                 return false;
+
+    ring     = static_cast<TelemetryRing*>(addr);
+    shm_name = _shm_name;
+
+    // Invalidate the magic first, so that readers do not attach
+    // to a half-initialized ring
+    ring->magic       = 0;
+    ring->version     = TELEMETRY_VERSION;
+    ring->capacity    = TELEMETRY_CAPACITY;
+    ring->sample_size = sizeof(TelemetrySample);
+    ring->head.store(0, memory_order_relaxed);
+    for (int i = 0; i < TELEMETRY_CAPACITY; ++i)
+    {
+        ring->slots[i].seq.store(0, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+    ring->magic       = TELEMETRY_MAGIC;
+
+    // Fault the pages in now rather than in the control loop
+    mlock(addr, sizeof(TelemetryRing));
+
+    return true;
+}
+
+void TelemetryWriter::close()
+{
+    if (ring == NULL)   return;
+
+    munmap(ring, sizeof(TelemetryRing));
+    shm_unlink(shm_name.c_str());
+    ring = NULL;
+}
+
+void TelemetryWriter::write(const TelemetrySample &s)
+{
+    if (ring == NULL)   return;
+
+    uint64_t       i = ring->head.load(memory_order_relaxed);
+    TelemetrySlot &slot = ring->slots[i % TELEMETRY_CAPACITY];
+
+    uint64_t seq = slot.seq.load(memory_order_relaxed);
+    slot.seq.store(seq + 1, memory_order_relaxed);      // odd: being written
+    atomic_thread_fence(memory_order_release);
+
+    slot.sample       = s;
+    slot.sample.index = i;
+
+    slot.seq.store(seq + 2, memory_order_release);      // even: consistent
+    ring->head.store(i + 1, memory_order_release);
+}
+
+TelemetryWriter::~TelemetryWriter()
+{
+    close();
+}
+
+/**************************************************************************/
+/*                            TelemetryReader                             */
+/**************************************************************************/
+
+TelemetryReader::TelemetryReader() : ring(NULL), cursor(0), dropped(0)
+{
+
+}
+
+bool TelemetryReader::open(const string &shm_name)
+{
+    close();
+
+    int fd = shm_open(shm_name.c_str(), O_RDONLY, 0);
+    if (fd < 0)                                             return false;
+
+    void *addr = mmap(NULL, sizeof(TelemetryRing), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)                                 return false;
+
+    ring = static_cast<const TelemetryRing*>(addr);
+
+    if (ring->magic       != TELEMETRY_MAGIC    ||
+        ring->version     != TELEMETRY_VERSION  ||
+        ring->capacity    != TELEMETRY_CAPACITY ||
+        ring->sample_size != sizeof(TelemetrySample))
+    {
+        close();
+        return false;
+    }
+
+    uint64_t head = ring->head.load(memory_order_acquire);
+    cursor  = head > 0 ? head - 1 : 0;
+    dropped = 0;
+
+    return true;
+}
+
+void TelemetryReader::close()
+{
+    if (ring == NULL)   return;
+
+    munmap(const_cast<TelemetryRing*>(ring), sizeof(TelemetryRing));
+    ring = NULL;
+}
+
+bool TelemetryReader::readSlot(uint64_t i, TelemetrySample &s)
+{
+    const TelemetrySlot &slot = ring->slots[i % TELEMETRY_CAPACITY];
+
+    uint64_t seq0 = slot.seq.load(memory_order_acquire);
+    if (seq0 & 1)                                           return false;
+
+    memcpy(&s, &slot.sample, sizeof(TelemetrySample));
+
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t seq1 = slot.seq.load(memory_order_relaxed);
+
+    return seq0 == seq1 && s.index == i;
+}
+
+bool TelemetryReader::next(TelemetrySample &s)
+{
+    if (ring == NULL)   return false;
+
+    while (true)
+    {
+        uint64_t head = ring->head.load(memory_order_acquire);
+        if (cursor >= head)                                 return false;
+
+        // The writer lapped us: skip to the oldest sample still in the ring
+        if (head - cursor > TELEMETRY_CAPACITY)
+        {
+            dropped += head - TELEMETRY_CAPACITY - cursor;
+            cursor   = head - TELEMETRY_CAPACITY;
+        }
+
+        if (readSlot(cursor, s))
+        {
+            ++cursor;
+            return true;
+        }
+
+        // Overwritten while reading: count it and move on
+        ++dropped;
+        ++cursor;
+    }
+}
+
+bool TelemetryReader::latest(TelemetrySample &s)
+{
+    if (ring == NULL)   return false;
+
+    // Bounded, so that a writer that died mid-write (leaving its slot odd
+    // and the segment behind) can not make the reader spin forever
+    uint64_t head = ring->head.load(memory_order_acquire);
+    for (uint64_t k = 1; k <= TELEMETRY_READ_ATTEMPTS && k <= head; ++k)
+    {
+        // Fall back to older samples if the newest ones are being rewritten
+        if (readSlot(head - k, s))
+        {
+            cursor = head - k + 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TelemetryReader::~TelemetryReader()
+{
+    close();
+}
@@ -0,0 +1,53 @@
+#include "baxter_interface/timing_stats.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+using namespace std;
+
+TimingStats::TimingStats(size_t _window) : samples(max(_window, size_t(1)), 0.0),
+                                           scratch(max(_window, size_t(1)), 0.0),
+                                           next(0), n(0), total(0)
+{
+
+}
+
+void TimingStats::add(double x)
+{
+    samples[next] = x;
+    next = (next + 1) % samples.size();
+    if (n < samples.size())     ++n;
+    ++total;
+}
+
+double TimingStats::percentile(double p)
+{
+    if (n == 0)     return 0.0;
+
+    p = min(max(p, 0.0), 100.0);
+
+    copy(samples.begin(), samples.begin() + n, scratch.begin());
+    size_t k = size_t(p / 100.0 * (n - 1) + 0.5);
+    nth_element(scratch.begin(), scratch.begin() + k, scratch.begin() + n);
+
+    return scratch[k];
+}
+
+double TimingStats::mean()
+{
+    if (n == 0)     return 0.0;
+
+    double sum = 0.0;
+    for (size_t i = 0; i < n; ++i)  sum += samples[i];
+
+    return sum / n;
+}
+
+string TimingStats::toString()
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "n %zu mean %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f [ms]",
+                               n, 1e3*mean(), 1e3*percentile(50), 1e3*percentile(90),
+                               1e3*percentile(99), 1e3*percentile(100));
+    return string(buf);
+}
@@ -4,6 +4,9 @@
 #include <ros/callback_queue.h>
 #include <signal.h>
 #include "baxter_interface/arm_ctrl.h"
+#include "baxter_interface/dual_arm_ctrl.h"
+#include "baxter_interface/marker_pipeline.h"
+#include "baxter_interface/stress_runner.h"
 
 using namespace std;
 
@@ -26,16 +29,74 @@ int main(int argc, char ** argv)
     printf("\n");
     ROS_INFO("use_robot flag set to %s", use_robot==true?"true":"false");
 
+    // Stress mode: many simulated controllers in this process, no robot
+    int stress_instances;
+    _n.param<int>("stress_instances", stress_instances, 0);
+    if (stress_instances > 0)
+    {
+        int stress_threads;
+        _n.param<int>("stress_threads", stress_threads, 4);
+        ROS_INFO("Stress mode: %i instances on %i spinner threads",
+                                 stress_instances, stress_threads);
+
+        signal(SIGINT, mySigintHandler);
+
+        // Started first: the controllers go home while they are being created
+        ros::AsyncSpinner spinner(stress_threads);
+        spinner.start();
+
+        StressRunner stress("move_baxter", stress_instances);
+        ros::waitForShutdown();
+        return 0;
+    }
+
+    bool dual_arm;
+    _n.param<bool>("dual_arm", dual_arm, false);
+    ROS_INFO("dual_arm flag set to %s", dual_arm==true?"true":"false");
+
+    bool aruco;
+    _n.param<bool>("aruco", aruco, false);
+    ROS_INFO("aruco flag set to %s", aruco==true?"true":"false");
+
     printf("\n");
-    // ArmCtrl  left_arm("move_baxter","left", !use_robot);
+    ArmCtrl *left_arm = NULL;
+    if (dual_arm)   left_arm = new ArmCtrl("move_baxter","left", !use_robot);
     printf("\n");
     ArmCtrl  right_arm("move_baxter","right", !use_robot);
     printf("\n");
+
+    // Coordinated bimanual motion, driven by a single scheduler
+    DualArmCtrl *dual_ctrl = NULL;
+    if (dual_arm)   dual_ctrl = new DualArmCtrl("move_baxter", left_arm, &right_arm);
+
+    // In-process marker detection, feeding the arms' targets and object caches
+    MarkerPipeline *markers = NULL;
+    if (aruco)
+    {
+        vector<ArmCtrl*> arms;
+        int marker_id;
+        if (left_arm != NULL)
+        {
+            _n.param<int>("marker_id_left", marker_id, -1);
+            left_arm->setMarkerID(marker_id);
+            arms.push_back(left_arm);
+        }
+        _n.param<int>("marker_id_right", marker_id, -1);
+        right_arm.setMarkerID(marker_id);
+        arms.push_back(&right_arm);
+
+        markers = new MarkerPipeline("move_baxter", arms);
+    }
+
     ROS_INFO("READY! Waiting for messages..\n");
 
     //Override the default ros sigint handler.
     signal(SIGINT, mySigintHandler);
 
     ros::spin();
+
+    delete markers;
+    delete dual_ctrl;
+    delete left_arm;
     return 0;
 }